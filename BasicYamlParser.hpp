@@ -6,30 +6,69 @@
 #pragma once
 
 #include <algorithm> // std::equal
+#include <array>
+#include <atomic>
 #include <cassert>
 #include <cctype>
 #include <charconv>
+#include <chrono>
 #include <climits>
+#include <cmath>
+#include <condition_variable>
+#include <cstdint>
+#include <cstring>
 #include <errno.h>
+#include <exception>
+#include <filesystem>
 #include <fstream>
+#include <functional>
 #include <iomanip>
 #include <ios> // For std::streamoff, std::ios
 #include <iostream>
+#include <iterator>
 #include <limits>
 #include <map>
+#include <memory>
+#include <mutex>
 #include <optional>
 #include <regex> // For folding if needed, but manual
+#include <shared_mutex>
 #include <sstream>
 #include <stdexcept>
 #include <string>
+#include <string_view>
+#include <thread>
 #include <type_traits> // For std::is_same_v, std::is_integral_v, etc.
+#include <unordered_map>
 #include <utility>
 #include <variant>
 #include <vector>
 
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+// Trace points feeding YamlParser::Trace. They compile to nothing unless BASIC_YAML_TRACE is nonzero.
+#ifndef BASIC_YAML_TRACE
+#define BASIC_YAML_TRACE 0
+#endif
+#if BASIC_YAML_TRACE
+#define YAML_TRACE_SCOPE(var, name, bytes) YamlParser::TraceScope var(name, bytes)
+#define YAML_TRACE_BYTES(var, n) var.setBytes(n)
+#else
+#define YAML_TRACE_SCOPE(var, name, bytes) (void)0
+#define YAML_TRACE_BYTES(var, n) (void)0
+#endif
+
+// Read counting in NodeView lookups for YamlParser::accessReport. Compiled out unless BASIC_YAML_ACCESS_TRACKING is set.
+#ifndef BASIC_YAML_ACCESS_TRACKING
+#define BASIC_YAML_ACCESS_TRACKING 0
+#endif
+
 enum class YamlNodeType { Scalar, Sequence, Mapping };
 
-enum class ScalarStyle { Plain, Literal, Folded };
+// Quoted marks a scalar written in quotes (or a JSON string): it is text even when it reads as a number, bool or null.
+enum class ScalarStyle { Plain, Literal, Folded, Quoted };
 
 /**
  * @brief Represents a node in the YAML AST.
@@ -45,8 +84,180 @@ struct YamlNode {
     std::map<std::string, YamlNode> mapping;
 
     explicit YamlNode(YamlNodeType t = YamlNodeType::Scalar) : type(t) {}
+
+    // Copying and destruction walk the tree with an explicit stack, so arbitrarily deep documents
+    // cannot overflow the call stack.
+    YamlNode(const YamlNode& other) : type(other.type), style(other.style), scalarValue(other.scalarValue) {
+        copyChildrenFrom(other);
+    }
+    YamlNode(YamlNode&& other) noexcept
+        : type(other.type), style(other.style), scalarValue(std::move(other.scalarValue)),
+          sequence(std::move(other.sequence)), mapping(std::move(other.mapping)),
+          attachments_(other.attachments_.exchange(nullptr, std::memory_order_relaxed)) {}
+    YamlNode& operator=(const YamlNode& other) {
+        if (this != &other) {
+            YamlNode copy(other);
+            *this = std::move(copy);
+        }
+        return *this;
+    }
+    YamlNode& operator=(YamlNode&& other) noexcept {
+        if (this != &other) {
+            // Keep the old contents alive until the end, since other may live inside them.
+            YamlNode old(std::move(*this));
+            type = other.type;
+            style = other.style;
+            scalarValue = std::move(other.scalarValue);
+            sequence = std::move(other.sequence);
+            mapping = std::move(other.mapping);
+            attachments_.store(other.attachments_.exchange(nullptr, std::memory_order_relaxed),
+                               std::memory_order_relaxed);
+        }
+        return *this;
+    }
+    ~YamlNode() {
+        if (!sequence.empty() || !mapping.empty())
+            releaseChildren();
+        if (attachments_.load(std::memory_order_relaxed))
+            dropAttachments(false);
+    }
+
+    /**
+     * @brief The value of type T derived from this node, computed by make(node) on first use.
+     *
+     * Lets applications keep compiled regexes, parsed addresses and the like beside the value
+     * they came from instead of in a side map. Storage is allocated on first use, one slot per
+     * type, and freed with the node. Concurrent callers may each run make, but all of them get
+     * the value installed first. Copies start without attachments; moves take them along.
+     * Call clearAttachments() after changing the node.
+     */
+    template <class T, class Make> const T& attachment(Make&& make) const {
+        if (const T* found = findAttachment<T>())
+            return *found;
+        auto* fresh = new TypedAttachment<T>(attachmentKey<T>(), make(*this));
+        Attachment* head = attachments_.load(std::memory_order_acquire);
+        do {
+            for (Attachment* a = head; a; a = a->next) {
+                if (a->key == fresh->key) { // Another thread got there first
+                    delete fresh;
+                    return static_cast<TypedAttachment<T>*>(a)->value;
+                }
+            }
+            fresh->next = head;
+        } while (!attachments_.compare_exchange_weak(head, fresh, std::memory_order_acq_rel,
+                                                     std::memory_order_acquire));
+        return fresh->value;
+    }
+
+    /**
+     * @brief The attached value of type T, or nullptr if none has been computed.
+     */
+    template <class T> const T* findAttachment() const {
+        for (Attachment* a = attachments_.load(std::memory_order_acquire); a; a = a->next)
+            if (a->key == attachmentKey<T>())
+                return &static_cast<TypedAttachment<T>*>(a)->value;
+        return nullptr;
+    }
+
+    /**
+     * @brief Drop the attached values derived from the node's contents. Types that declare
+     * `static constexpr bool kKeepOnClear = true` (such as access counters) are kept.
+     * Not safe while other threads read this node's attachments.
+     */
+    void clearAttachments() { dropAttachments(true); }
+
+  private:
+    struct Attachment {
+        const void* key;
+        bool keepOnClear;
+        Attachment* next = nullptr;
+        Attachment(const void* k, bool keep) : key(k), keepOnClear(keep) {}
+        virtual ~Attachment() = default;
+    };
+    template <class T, class = void> struct KeepsOnClear : std::false_type {};
+    template <class T>
+    struct KeepsOnClear<T, std::void_t<decltype(T::kKeepOnClear)>> : std::bool_constant<T::kKeepOnClear> {};
+    template <class T> struct TypedAttachment : Attachment {
+        T value;
+        TypedAttachment(const void* k, T&& v) : Attachment(k, KeepsOnClear<T>::value), value(std::move(v)) {}
+    };
+    // One address per type; no RTTI needed.
+    template <class T> static const void* attachmentKey() {
+        static const char key = 0;
+        return &key;
+    }
+
+    mutable std::atomic<Attachment*> attachments_{nullptr}; // Lock-free list, newest first
+
+    void dropAttachments(bool keepSome) {
+        Attachment* a = attachments_.exchange(nullptr, std::memory_order_acq_rel);
+        Attachment* kept = nullptr;
+        while (a) {
+            Attachment* next = a->next;
+            if (keepSome && a->keepOnClear) {
+                a->next = kept;
+                kept = a;
+            } else {
+                delete a;
+            }
+            a = next;
+        }
+        if (kept)
+            attachments_.store(kept, std::memory_order_release);
+    }
+
+    YamlNode(const YamlNode& other, bool /*shallow*/)
+        : type(other.type), style(other.style), scalarValue(other.scalarValue) {}
+
+    void copyChildrenFrom(const YamlNode& other) {
+        std::vector<std::pair<YamlNode*, const YamlNode*>> pending = {{this, &other}};
+        while (!pending.empty()) {
+            auto [dst, src] = pending.back();
+            pending.pop_back();
+            dst->sequence.reserve(src->sequence.size()); // Element addresses stay put while queued
+            for (const YamlNode& child : src->sequence) {
+                dst->sequence.push_back(YamlNode(child, true));
+                if (!child.sequence.empty() || !child.mapping.empty())
+                    pending.emplace_back(&dst->sequence.back(), &child);
+            }
+            for (const auto& [key, child] : src->mapping) {
+                YamlNode& copy = dst->mapping.emplace_hint(dst->mapping.end(), key, YamlNode(child, true))->second;
+                if (!child.sequence.empty() || !child.mapping.empty())
+                    pending.emplace_back(&copy, &child);
+            }
+        }
+    }
+
+    // Detach every nested collection into a flat list first, so each node is destroyed with no children left.
+    // push_back leaves the list and the child untouched when it throws, so a list that cannot grow
+    // falls back to recursion rather than terminating from the noexcept destructor.
+    void releaseChildren() noexcept {
+        std::vector<YamlNode> pending;
+        auto detach = [&pending](YamlNode& n) noexcept {
+            try {
+                for (YamlNode& child : n.sequence)
+                    if (!child.sequence.empty() || !child.mapping.empty())
+                        pending.push_back(std::move(child));
+                for (auto& kv : n.mapping)
+                    if (!kv.second.sequence.empty() || !kv.second.mapping.empty())
+                        pending.push_back(std::move(kv.second));
+            } catch (...) { // Out of memory: the clear() below destroys what is still attached recursively
+            }
+            n.sequence.clear();
+            n.mapping.clear();
+        };
+        detach(*this);
+        while (!pending.empty()) {
+            YamlNode n = std::move(pending.back());
+            pending.pop_back();
+            detach(n);
+        }
+    }
 };
 
+// Vectors of nodes must relocate by moving, never by deep copies.
+static_assert(std::is_nothrow_move_constructible_v<YamlNode>);
+
 /**
  * @brief Custom error for YAML parsing issues, including position info.
  */
@@ -59,28 +270,262 @@ struct YamlError : std::runtime_error {
 class YamlParser {
   public:
     /**
-     * @brief Parse YAML from a string.
+     * @brief What one parse cost, filled in when a ParseStats* is passed to parse/parseFile/load*.
+     *
+     * Node counts, depth and scalar bytes describe the resulting tree. allocations/allocatedBytes
+     * count the heap blocks that tree holds (strings past the small-string buffer, sequence
+     * buffers, map entries); the parser's own short-lived temporaries are not included. Phase
+     * times add up to totalTime: scanning is reading lines and measuring indentation, build is
+     * attaching nodes, and a JSON document is counted entirely as flow parsing.
+     */
+    struct ParseStats {
+        size_t lines = 0;
+        size_t bytes = 0;
+        size_t scalars = 0;
+        size_t sequences = 0;
+        size_t mappings = 0;
+        size_t maxDepth = 0;       // Of the tree; the root is depth 0
+        size_t scalarBytes = 0;
+        size_t allocations = 0;
+        size_t allocatedBytes = 0;
+        size_t peakStackDepth = 0; // Open block collections (or JSON nesting) at the deepest point
+        std::chrono::nanoseconds scanTime{0};
+        std::chrono::nanoseconds blockScalarTime{0};
+        std::chrono::nanoseconds flowTime{0};
+        std::chrono::nanoseconds buildTime{0};
+        std::chrono::nanoseconds totalTime{0};
+
+        size_t nodes() const { return scalars + sequences + mappings; }
+    };
+
+    // ---- Tracing ----
+
+    /**
+     * @brief Timed events kept in per-thread ring buffers and written out in Chrome trace JSON.
+     *
+     * Built with BASIC_YAML_TRACE=1, the parser records file reads, parses, JSON documents, block
+     * scalars, flow collections, freezes and emits here, with byte counts; line scanning and tree
+     * building are the time inside a parse not covered by its nested events. Without it nothing
+     * is recorded, though applications can still time their own scopes with TraceScope. Each
+     * thread keeps its latest kRingCapacity events in a ring only it writes, without locking;
+     * readers check a per-slot stamp and skip events overwritten while they were being copied.
+     * Open the output in Perfetto or chrome://tracing.
+     */
+    class Trace {
+      public:
+        struct Event {
+            const char* name;   // Must outlive the trace; normally a literal
+            int64_t startNs;    // steady_clock time
+            int64_t durationNs;
+            uint64_t bytes;
+            uint32_t thread;
+        };
+
+        static constexpr size_t kRingCapacity = 4096;
+
+        static void record(const char* name, std::chrono::steady_clock::time_point start,
+                           std::chrono::steady_clock::time_point end, uint64_t bytes = 0) {
+            Ring& ring = localRing();
+            uint64_t i = ring.next.load(std::memory_order_relaxed);
+            Slot& slot = ring.slots[i % kRingCapacity];
+            slot.stamp.store(0, std::memory_order_relaxed); // Readers drop the slot until it is restamped
+            std::atomic_thread_fence(std::memory_order_release);
+            slot.name.store(name, std::memory_order_relaxed);
+            slot.startNs.store(std::chrono::duration_cast<std::chrono::nanoseconds>(start.time_since_epoch()).count(),
+                               std::memory_order_relaxed);
+            slot.durationNs.store(std::chrono::duration_cast<std::chrono::nanoseconds>(end - start).count(),
+                                  std::memory_order_relaxed);
+            slot.bytes.store(bytes, std::memory_order_relaxed);
+            slot.stamp.store(i + 1, std::memory_order_release);
+            ring.next.store(i + 1, std::memory_order_release);
+        }
+
+        /**
+         * @brief Every buffered event from every thread, oldest first.
+         */
+        static std::vector<Event> snapshot() {
+            std::vector<Event> all;
+            Registry& reg = registry();
+            std::lock_guard<std::mutex> regLock(reg.mutex);
+            for (const auto& ring : reg.rings) {
+                uint64_t next = ring->next.load(std::memory_order_acquire);
+                uint64_t first = std::max(ring->floor.load(std::memory_order_relaxed),
+                                          next > kRingCapacity ? next - kRingCapacity : 0);
+                for (uint64_t i = first; i < next; ++i) {
+                    const Slot& slot = ring->slots[i % kRingCapacity];
+                    uint64_t stamp = slot.stamp.load(std::memory_order_acquire);
+                    Event e{slot.name.load(std::memory_order_relaxed), slot.startNs.load(std::memory_order_relaxed),
+                            slot.durationNs.load(std::memory_order_relaxed), slot.bytes.load(std::memory_order_relaxed),
+                            ring->thread};
+                    std::atomic_thread_fence(std::memory_order_acquire);
+                    if (stamp == i + 1 && slot.stamp.load(std::memory_order_relaxed) == stamp)
+                        all.push_back(e);
+                }
+            }
+            std::stable_sort(all.begin(), all.end(),
+                             [](const Event& a, const Event& b) { return a.startNs < b.startNs; });
+            return all;
+        }
+
+        /**
+         * @brief Events overwritten before they could be written out, over all threads.
+         */
+        static uint64_t dropped() {
+            uint64_t n = 0;
+            Registry& reg = registry();
+            std::lock_guard<std::mutex> regLock(reg.mutex);
+            for (const auto& ring : reg.rings) {
+                uint64_t held =
+                    ring->next.load(std::memory_order_acquire) - ring->floor.load(std::memory_order_relaxed);
+                n += held > kRingCapacity ? held - kRingCapacity : 0;
+            }
+            return n;
+        }
+
+        /**
+         * @brief Discard all buffered events, and the buffers of threads that have exited.
+         */
+        static void clear() {
+            Registry& reg = registry();
+            std::lock_guard<std::mutex> regLock(reg.mutex);
+            auto exited = [](const std::shared_ptr<Ring>& r) { return r.use_count() == 1; };
+            reg.rings.erase(std::remove_if(reg.rings.begin(), reg.rings.end(), exited), reg.rings.end());
+            // Only the owning thread moves next, so mark where its events restart instead
+            for (const auto& ring : reg.rings)
+                ring->floor.store(ring->next.load(std::memory_order_acquire), std::memory_order_relaxed);
+        }
+
+        /**
+         * @brief Write the buffered events as a Chrome trace ("X" complete events, microsecond timestamps).
+         */
+        static void writeChromeTrace(std::ostream& os) {
+            std::vector<Event> events = snapshot();
+            int64_t origin = events.empty() ? 0 : events.front().startNs;
+            std::string buf = "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[";
+            StringOutput out{buf};
+            char num[32];
+            auto micros = [&](int64_t ns) {
+                auto r = std::to_chars(num, num + sizeof(num), static_cast<double>(ns) / 1000.0,
+                                       std::chars_format::fixed, 3);
+                out.write(num, static_cast<size_t>(r.ptr - num));
+            };
+            auto integer = [&](uint64_t v) {
+                auto r = std::to_chars(num, num + sizeof(num), v);
+                out.write(num, static_cast<size_t>(r.ptr - num));
+            };
+            for (size_t i = 0; i < events.size(); ++i) {
+                const Event& e = events[i];
+                buf += i ? ",\n{\"name\":" : "\n{\"name\":";
+                writeJsonString(out, e.name);
+                buf += ",\"cat\":\"yaml\",\"ph\":\"X\",\"pid\":1,\"tid\":";
+                integer(e.thread);
+                buf += ",\"ts\":";
+                micros(e.startNs - origin);
+                buf += ",\"dur\":";
+                micros(e.durationNs);
+                buf += ",\"args\":{\"bytes\":";
+                integer(e.bytes);
+                buf += "}}";
+            }
+            buf += "\n]}\n";
+            os.write(buf.data(), static_cast<std::streamsize>(buf.size()));
+        }
+        static void writeChromeTrace(const std::string& filename) {
+            std::ofstream file(filename, std::ios::binary);
+            if (!file.is_open())
+                throw YamlError("Cannot open file: " + filename);
+            writeChromeTrace(file);
+        }
+
+      private:
+        // An event's fields, stored as atomics so a reader racing the owning thread stays well defined.
+        struct Slot {
+            std::atomic<uint64_t> stamp{0}; // 1 + index of the event held; 0 while it is being written
+            std::atomic<const char*> name{nullptr};
+            std::atomic<int64_t> startNs{0};
+            std::atomic<int64_t> durationNs{0};
+            std::atomic<uint64_t> bytes{0};
+        };
+        struct Ring {
+            std::unique_ptr<Slot[]> slots{new Slot[kRingCapacity]};
+            std::atomic<uint64_t> next{0};  // Index of the next event; written only by the owning thread
+            std::atomic<uint64_t> floor{0}; // Events below this index were cleared
+            uint32_t thread = 0;
+        };
+        struct Registry {
+            std::mutex mutex;
+            std::vector<std::shared_ptr<Ring>> rings;
+            uint32_t nextThread = 1;
+        };
+
+        static Registry& registry() {
+            static Registry reg;
+            return reg;
+        }
+        // The registry shares ownership so a thread's events can still be written out after it exits.
+        static Ring& localRing() {
+            thread_local std::shared_ptr<Ring> ring = [] {
+                auto r = std::make_shared<Ring>();
+                Registry& reg = registry();
+                std::lock_guard<std::mutex> lock(reg.mutex);
+                r->thread = reg.nextThread++;
+                reg.rings.push_back(r);
+                return r;
+            }();
+            return *ring;
+        }
+    };
+
+    /**
+     * @brief Records one Trace event covering its own lifetime.
+     */
+    class TraceScope {
+      public:
+        explicit TraceScope(const char* name, uint64_t bytes = 0)
+            : name_(name), bytes_(bytes), start_(std::chrono::steady_clock::now()) {}
+        TraceScope(const TraceScope&) = delete;
+        TraceScope& operator=(const TraceScope&) = delete;
+        ~TraceScope() { Trace::record(name_, start_, std::chrono::steady_clock::now(), bytes_); }
+        void setBytes(uint64_t n) { bytes_ = n; }
+
+      private:
+        const char* name_;
+        uint64_t bytes_;
+        std::chrono::steady_clock::time_point start_;
+    };
+
+    /**
+     * @brief Parse YAML from a string. JSON input (first non-blank byte '{' or '[') takes the parseJson fast path.
      * @param input The YAML text.
-     * @return Root YamlNode (always Mapping).
+     * @param stats Optional; filled with counts and timings for this parse. Null costs nothing.
+     * @return Root YamlNode (a Mapping, or a Sequence for a JSON array).
      * @throws YamlError on parse failure.
      */
-    static YamlNode parse(const std::string& input) {
-        std::stringstream ss(input);
-        return parseStream(ss);
+    static YamlNode parse(const std::string& input, ParseStats* stats = nullptr) {
+        YAML_TRACE_SCOPE(trace, "parse", input.size());
+        StatsSession session(stats);
+        YamlNode root = parseText(input, stats);
+        session.finish(root);
+        return root;
     }
 
     /**
      * @brief Parse YAML from a file.
      * @param filename Path to YAML file.
+     * @param stats Optional; filled with counts and timings for this parse.
      * @return Root YamlNode.
      * @throws YamlError if file open fails or parse error.
      */
-    static YamlNode parseFile(const std::string& filename) {
+    static YamlNode parseFile(const std::string& filename, ParseStats* stats = nullptr) {
         std::ifstream file(filename);
         if (!file.is_open()) {
             throw YamlError("Cannot open file: " + filename);
         }
-        return parseStream(file);
+        YAML_TRACE_SCOPE(trace, "parseFile", fileSizeOrZero(filename));
+        StatsSession session(stats);
+        YamlNode root = parseStream(file, stats);
+        session.finish(root);
+        return root;
     }
 
     /**
@@ -89,58 +534,59 @@ class YamlParser {
      * @param indent Current indentation level.
      */
     static void printYamlNode(const YamlNode& node, int indent = 0) {
-        std::string indentStr(indent * 2, ' ');
-
-        switch (node.type) {
-        case YamlNodeType::Scalar:
-            if (node.style == ScalarStyle::Literal) {
-                std::cout << indentStr << "|" << std::endl;
-                std::istringstream iss(node.scalarValue);
-                std::string subline;
-                int subindent = indent + 1;
-                std::string subIndentStr(subindent * 2, ' ');
-                while (std::getline(iss, subline)) {
-                    std::cout << subIndentStr << subline << std::endl;
-                }
-            } else if (node.style == ScalarStyle::Folded) {
-                std::cout << indentStr << ">" << std::endl;
-                std::istringstream iss(node.scalarValue);
-                std::string subline;
-                int subindent = indent + 1;
-                std::string subIndentStr(subindent * 2, ' ');
-                while (std::getline(iss, subline)) {
-                    std::cout << subIndentStr << subline << std::endl;
-                }
-            } else {
-                std::cout << indentStr << node.scalarValue << std::endl;
+        traverse(node, [indent](const YamlNode& n, const TraversalContext& ctx) {
+            if (ctx.depth == 0) {
+                if (n.type == YamlNodeType::Scalar)
+                    printScalar(n, indent);
+                return true;
             }
-            break;
-        case YamlNodeType::Sequence:
-            for (const auto& item : node.sequence) {
+            std::string indentStr(static_cast<size_t>(indent + static_cast<int>(ctx.depth) - 1) * 2, ' ');
+            if (ctx.parent->type == YamlNodeType::Sequence) {
                 std::cout << indentStr << "- ";
-                if (item.type == YamlNodeType::Scalar) {
-                    std::cout << item.scalarValue << std::endl;
-                } else {
-                    std::cout << std::endl;
-                    printYamlNode(item, indent + 1);
+                if (n.type == YamlNodeType::Scalar) {
+                    std::cout << n.scalarValue << std::endl;
+                    return false;
                 }
+                std::cout << std::endl;
+                return true;
             }
-            break;
-        case YamlNodeType::Mapping:
-            for (const auto& pair : node.mapping) {
-                const std::string& key = pair.first;
-                const YamlNode& value = pair.second;
-                if (value.type == YamlNodeType::Scalar) {
-                    std::cout << indentStr << key << ": " << value.scalarValue << std::endl;
-                } else {
-                    std::cout << indentStr << key << ":" << std::endl;
-                    printYamlNode(value, indent + 1);
-                }
+            if (n.type == YamlNodeType::Scalar) {
+                std::cout << indentStr << *ctx.key << ": " << n.scalarValue << std::endl;
+                return false;
             }
-            break;
+            std::cout << indentStr << *ctx.key << ":" << std::endl;
+            return true;
+        });
+    }
+
+  private:
+    // A scalar printed on its own, as printYamlNode does for a scalar root.
+    static void printScalar(const YamlNode& node, int indent) {
+        std::string indentStr(indent * 2, ' ');
+        if (node.style == ScalarStyle::Literal) {
+            std::cout << indentStr << "|" << std::endl;
+            std::istringstream iss(node.scalarValue);
+            std::string subline;
+            int subindent = indent + 1;
+            std::string subIndentStr(subindent * 2, ' ');
+            while (std::getline(iss, subline)) {
+                std::cout << subIndentStr << subline << std::endl;
+            }
+        } else if (node.style == ScalarStyle::Folded) {
+            std::cout << indentStr << ">" << std::endl;
+            std::istringstream iss(node.scalarValue);
+            std::string subline;
+            int subindent = indent + 1;
+            std::string subIndentStr(subindent * 2, ' ');
+            while (std::getline(iss, subline)) {
+                std::cout << subIndentStr << subline << std::endl;
+            }
+        } else {
+            std::cout << indentStr << node.scalarValue << std::endl;
         }
     }
 
+  public:
     /**
      * @brief Deduce YAML scalar type (string, int, double, bool, null).
      * @param val The scalar string.
@@ -182,7 +628,7 @@ class YamlParser {
     /**
      * @brief Case-insensitive string equality.
      */
-    static bool iequals(const std::string& a, const std::string& b) {
+    static bool iequals(std::string_view a, std::string_view b) {
         return std::equal(a.begin(), a.end(), b.begin(), b.end(), [](char c1, char c2) {
             return std::tolower(static_cast<unsigned char>(c1)) == std::tolower(static_cast<unsigned char>(c2));
         });
@@ -252,195 +698,4944 @@ class YamlParser {
     }
 
     /**
-     * @brief Lightweight view with path lookup.
+     * @brief Lightweight view with path lookup.
+     */
+    struct NodeView {
+        const YamlNode* n{nullptr};
+
+        explicit operator bool() const { return n != nullptr; }
+        bool is_scalar() const { return n && n->type == YamlNodeType::Scalar; }
+        bool is_map() const { return n && n->type == YamlNodeType::Mapping; }
+        bool is_seq() const { return n && n->type == YamlNodeType::Sequence; }
+
+        const std::string& as_str() const { return YamlParser::asString(*n); }
+        const std::map<std::string, YamlNode>& as_map() const { return YamlParser::asMap(*n); }
+        const std::vector<YamlNode>& as_seq() const { return YamlParser::asSeq(*n); }
+
+        std::optional<bool> to_bool() const { return YamlParser::toBool(*n); }
+        std::optional<long long> to_int() const { return YamlParser::toInt(*n); }
+        std::optional<double> to_double() const { return YamlParser::toDouble(*n); }
+
+        // See YamlNode::attachment. Throws YamlError on an empty view.
+        template <class T, class Make> const T& attachment(Make&& make) const {
+            if (!n)
+                throw YamlError("attachment() on an empty view");
+            return n->attachment<T>(std::forward<Make>(make));
+        }
+
+        NodeView operator[](const std::string& key) const {
+            if (!is_map())
+                return {};
+            auto it = n->mapping.find(key);
+            if (it == n->mapping.end())
+                return {};
+            return reached(&it->second);
+        }
+        NodeView operator[](size_t idx) const {
+            if (!is_seq())
+                return {};
+            if (idx >= n->sequence.size())
+                return {};
+            return reached(&n->sequence[idx]);
+        }
+
+        // A child handed out by a lookup or a range; counted as a read when access tracking is built in.
+        static NodeView reached(const YamlNode* child) {
+#if BASIC_YAML_ACCESS_TRACKING
+            YamlParser::recordAccess(*child);
+#endif
+            return NodeView{child};
+        }
+
+        /**
+         * @brief Range over a sequence's elements as NodeViews; empty unless this is a sequence.
+         */
+        class ElementRange {
+          public:
+            class iterator {
+              public:
+                using iterator_category = std::forward_iterator_tag;
+                using value_type = NodeView;
+                using difference_type = std::ptrdiff_t;
+                using pointer = void;
+                using reference = NodeView;
+
+                explicit iterator(const YamlNode* p = nullptr) : p_(p) {}
+                NodeView operator*() const { return reached(p_); }
+                iterator& operator++() {
+                    ++p_;
+                    return *this;
+                }
+                iterator operator++(int) { return iterator(p_++); }
+                bool operator==(const iterator& o) const { return p_ == o.p_; }
+                bool operator!=(const iterator& o) const { return p_ != o.p_; }
+
+              private:
+                const YamlNode* p_;
+            };
+
+            ElementRange(const YamlNode* first, size_t count) : first_(first), count_(count) {}
+            iterator begin() const { return iterator(first_); }
+            iterator end() const { return iterator(first_ + count_); }
+            size_t size() const { return count_; }
+            bool empty() const { return count_ == 0; }
+
+          private:
+            const YamlNode* first_;
+            size_t count_;
+        };
+
+        /**
+         * @brief Range over a mapping's entries as (key, NodeView) pairs; empty unless this is a mapping.
+         */
+        class ItemRange {
+            using MapIt = std::map<std::string, YamlNode>::const_iterator;
+
+          public:
+            class iterator {
+              public:
+                using iterator_category = std::forward_iterator_tag;
+                using value_type = std::pair<std::string_view, NodeView>;
+                using difference_type = std::ptrdiff_t;
+                using pointer = void;
+                using reference = value_type;
+
+                iterator() = default;
+                explicit iterator(MapIt it) : it_(it) {}
+                value_type operator*() const { return {it_->first, reached(&it_->second)}; }
+                iterator& operator++() {
+                    ++it_;
+                    return *this;
+                }
+                iterator operator++(int) { return iterator(it_++); }
+                bool operator==(const iterator& o) const { return it_ == o.it_; }
+                bool operator!=(const iterator& o) const { return it_ != o.it_; }
+
+              private:
+                MapIt it_;
+            };
+
+            ItemRange(MapIt first, MapIt last) : first_(first), last_(last) {}
+            iterator begin() const { return iterator(first_); }
+            iterator end() const { return iterator(last_); }
+
+          private:
+            MapIt first_, last_;
+        };
+
+        /**
+         * @brief Pre-order range over every node below a view (not the view itself).
+         *
+         * Mapping values come in key order, sequence elements in index order. The iterator keeps
+         * its position stack inline for the first kInlineDepth levels and only allocates for
+         * deeper documents.
+         */
+        class DescendantRange {
+          public:
+            class iterator {
+              public:
+                static constexpr size_t kInlineDepth = 16;
+
+                using iterator_category = std::forward_iterator_tag;
+                using value_type = NodeView;
+                using difference_type = std::ptrdiff_t;
+                using pointer = void;
+                using reference = NodeView;
+
+                iterator() = default;
+                explicit iterator(const YamlNode* root) {
+                    if (root)
+                        push(*root);
+                    settle();
+                }
+
+                NodeView operator*() const { return NodeView{cur_}; }
+                // Nesting level of the current node; its direct children are at depth 1.
+                size_t depth() const { return size_; }
+                iterator& operator++() {
+                    push(*cur_);
+                    settle();
+                    return *this;
+                }
+                iterator operator++(int) {
+                    iterator old = *this;
+                    ++*this;
+                    return old;
+                }
+                bool operator==(const iterator& o) const { return cur_ == o.cur_; }
+                bool operator!=(const iterator& o) const { return cur_ != o.cur_; }
+
+              private:
+                // A container being walked: the next element index, or the next mapping entry.
+                struct Frame {
+                    const YamlNode* node = nullptr;
+                    size_t next = 0;
+                    std::map<std::string, YamlNode>::const_iterator it;
+                };
+
+                Frame& frame(size_t i) { return i < kInlineDepth ? inline_[i] : spill_[i - kInlineDepth]; }
+
+                void push(const YamlNode& n) {
+                    if (n.type == YamlNodeType::Scalar)
+                        return;
+                    if (size_ >= kInlineDepth)
+                        spill_.resize(size_ + 1 - kInlineDepth);
+                    frame(size_++) = Frame{&n, 0, n.mapping.begin()};
+                }
+
+                // Advance cur_ to the next unvisited child, popping exhausted containers; null at the end.
+                void settle() {
+                    cur_ = nullptr;
+                    while (size_ > 0) {
+                        Frame& f = frame(size_ - 1);
+                        if (f.node->type == YamlNodeType::Sequence && f.next < f.node->sequence.size()) {
+                            cur_ = &f.node->sequence[f.next++];
+                            return;
+                        }
+                        if (f.node->type == YamlNodeType::Mapping && f.it != f.node->mapping.end()) {
+                            cur_ = &(f.it++)->second;
+                            return;
+                        }
+                        --size_;
+                    }
+                }
+
+                const YamlNode* cur_ = nullptr;
+                size_t size_ = 0;
+                std::array<Frame, kInlineDepth> inline_{};
+                std::vector<Frame> spill_;
+            };
+
+            explicit DescendantRange(const YamlNode* root) : root_(root) {}
+            iterator begin() const { return iterator(root_); }
+            iterator end() const { return iterator(); }
+
+          private:
+            const YamlNode* root_;
+        };
+
+        ElementRange elements() const {
+            return is_seq() ? ElementRange(n->sequence.data(), n->sequence.size()) : ElementRange(nullptr, 0);
+        }
+        ItemRange items() const {
+            static const std::map<std::string, YamlNode> kEmpty;
+            const auto& m = is_map() ? n->mapping : kEmpty;
+            return ItemRange(m.begin(), m.end());
+        }
+        DescendantRange descendants() const { return DescendantRange(n); }
+
+        // Path such as "a.b[2].c". A key holding '.', '[', ']' or '"' is written ["a.b"] (see appendPathKey).
+        NodeView at_path(std::string_view path) const {
+            NodeView cur{n};
+            std::string token;
+            bool found = forEachPathStep(path, [&](std::string_view key, size_t index, bool isIndex) {
+                if (isIndex) {
+                    cur = cur[index];
+                } else {
+                    token.assign(key.data(), key.size());
+                    cur = cur[token];
+                }
+                return static_cast<bool>(cur);
+            });
+            return found ? cur : NodeView{};
+        }
+
+        template <class T> T value(std::string_view path, T def) const {
+            NodeView v = at_path(path);
+            if (!v)
+                return def;
+            if constexpr (std::is_same_v<T, std::string>) {
+                return v.is_scalar() ? v.as_str() : def;
+            } else if constexpr (std::is_same_v<T, const char*>) {
+                return v.is_scalar() ? v.as_str().c_str() : def;
+            } else if constexpr (std::is_same_v<T, bool>) {
+                auto b = v.to_bool();
+                return b ? *b : def;
+            } else if constexpr (std::is_integral_v<T> && !std::is_same_v<T, bool>) {
+                auto i = v.to_int();
+                return i ? static_cast<T>(*i) : def;
+            } else if constexpr (std::is_floating_point_v<T>) {
+                auto d = v.to_double();
+                return d ? static_cast<T>(*d) : def;
+            } else {
+                return def;
+            }
+        }
+    };
+
+    // ---- Iterative traversal ----
+
+    /**
+     * @brief Position of a node during traverse(): its depth below the root and where it sits in its parent.
+     */
+    struct TraversalContext {
+        size_t depth = 0;
+        const YamlNode* parent = nullptr; // Null for the root
+        const std::string* key = nullptr; // The mapping key, when the parent is a mapping
+        size_t index = 0;                 // Position among the parent's children
+    };
+
+    /**
+     * @brief Depth-first walk of root with an explicit stack instead of recursion.
+     *
+     * pre(node, ctx) runs when a node is reached and returns whether to walk its children;
+     * post(node, ctx) runs after them, for every node whose pre returned true. Mapping values
+     * come in key order. The first kInlineDepth levels of the stack live in the call frame and
+     * deeper ones on the heap, so shallow walks do not allocate and nesting depth is bounded by
+     * memory rather than by the thread's stack size.
+     */
+    template <class Pre, class Post> static void traverse(const YamlNode& root, Pre&& pre, Post&& post) {
+        struct Frame {
+            const YamlNode* node;
+            TraversalContext ctx;
+            size_t next;
+            std::map<std::string, YamlNode>::const_iterator it;
+        };
+        TraversalContext rootCtx;
+        if (!pre(root, rootCtx))
+            return;
+        if (root.type == YamlNodeType::Scalar) {
+            post(root, rootCtx);
+            return;
+        }
+        constexpr size_t kInlineDepth = 16;
+        std::array<Frame, kInlineDepth> inlineFrames;
+        std::vector<Frame> spill; // Levels beyond kInlineDepth
+        size_t size = 0;
+        auto top = [&]() -> Frame& { return size <= kInlineDepth ? inlineFrames[size - 1] : spill.back(); };
+        auto push = [&](const Frame& f) {
+            if (size < kInlineDepth)
+                inlineFrames[size] = f;
+            else
+                spill.push_back(f);
+            ++size;
+        };
+        push(Frame{&root, rootCtx, 0, root.mapping.begin()});
+        while (size > 0) {
+            // Run through the top frame's children until one needs a frame of its own.
+            Frame& f = top();
+            TraversalContext ctx{f.ctx.depth + 1, f.node, nullptr, 0};
+            const YamlNode* descend = nullptr;
+            if (f.node->type == YamlNodeType::Sequence) {
+                const std::vector<YamlNode>& items = f.node->sequence;
+                while (!descend && f.next < items.size()) {
+                    ctx.index = f.next;
+                    const YamlNode& child = items[f.next++];
+                    if (!pre(child, ctx))
+                        continue;
+                    if (child.type == YamlNodeType::Scalar)
+                        post(child, ctx);
+                    else
+                        descend = &child;
+                }
+            } else {
+                const auto end = f.node->mapping.end();
+                while (!descend && f.it != end) {
+                    ctx.index = f.next++;
+                    ctx.key = &f.it->first;
+                    const YamlNode& child = (f.it++)->second;
+                    if (!pre(child, ctx))
+                        continue;
+                    if (child.type == YamlNodeType::Scalar)
+                        post(child, ctx);
+                    else
+                        descend = &child;
+                }
+            }
+            if (descend) {
+                push(Frame{descend, ctx, 0, descend->mapping.begin()});
+            } else {
+                const YamlNode* done = f.node;
+                TraversalContext doneCtx = f.ctx;
+                if (size-- > kInlineDepth)
+                    spill.pop_back();
+                post(*done, doneCtx);
+            }
+        }
+    }
+    template <class Pre> static void traverse(const YamlNode& root, Pre&& pre) {
+        traverse(root, pre, [](const YamlNode&, const TraversalContext&) {});
+    }
+
+    // ---- Paths ----
+
+    /**
+     * @brief One step of a path: a mapping key, or a sequence index when isIndex is set.
+     */
+    struct PathSegment {
+        std::string key;
+        size_t index = 0;
+        bool isIndex = false;
+    };
+
+    /**
+     * @brief Call step(key, index, isIndex) for each step of a path such as "a.b[2].c", stopping
+     * when it returns false. This is the one path grammar: NodeView::at_path, ConcurrentDocument,
+     * column specs and queries all read paths through it. A ["..."] step holds any key, with a
+     * backslash before '"' or '\'; its key is only valid during the call.
+     * @return false if the path is malformed (unterminated step, non-numeric index) or step stopped the walk.
+     */
+    template <class Step> static bool forEachPathStep(std::string_view path, Step&& step) {
+        std::string unescaped; // Quoted keys with backslashes only
+        size_t i = 0;
+        while (i < path.size()) {
+            if (path[i] == '.') {
+                ++i;
+                continue;
+            }
+            if (path[i] != '[') {
+                size_t stop = i; // A plain loop: find_first_of measured far slower on short keys
+                while (stop < path.size() && path[stop] != '.' && path[stop] != '[')
+                    ++stop;
+                if (!step(path.substr(i, stop - i), 0, false))
+                    return false;
+                i = stop;
+                continue;
+            }
+            if (i + 1 < path.size() && path[i + 1] == '"') {
+                size_t close = i + 2;
+                bool escaped = false;
+                while (close < path.size() && path[close] != '"') {
+                    if (path[close] == '\\') {
+                        escaped = true;
+                        ++close;
+                    }
+                    ++close;
+                }
+                if (close + 1 >= path.size() || path[close + 1] != ']')
+                    return false;
+                std::string_view key = path.substr(i + 2, close - i - 2);
+                if (escaped) {
+                    unescaped.clear();
+                    for (size_t k = 0; k < key.size(); ++k)
+                        unescaped += key[k] == '\\' ? key[++k] : key[k];
+                    key = unescaped;
+                }
+                if (!step(key, 0, false))
+                    return false;
+                i = close + 2;
+                continue;
+            }
+            size_t close = path.find(']', i);
+            size_t index = 0;
+            auto r = std::from_chars(path.data() + i + 1, path.data() + std::min(close, path.size()), index);
+            if (close == std::string_view::npos || r.ec != std::errc{} || r.ptr != path.data() + close)
+                return false;
+            if (!step(std::string_view{}, index, true))
+                return false;
+            i = close + 1;
+        }
+        return true;
+    }
+
+    /**
+     * @brief Split a path into its steps (see forEachPathStep), reusing the strings already in out.
+     * @return false if the path is malformed.
+     */
+    static bool splitPath(std::string_view path, std::vector<PathSegment>& out) {
+        size_t used = 0;
+        bool ok = forEachPathStep(path, [&](std::string_view key, size_t index, bool isIndex) {
+            if (used == out.size())
+                out.emplace_back();
+            PathSegment& seg = out[used++];
+            seg.key.assign(key.data(), key.size());
+            seg.index = index;
+            seg.isIndex = isIndex;
+            return true;
+        });
+        out.resize(used);
+        return ok;
+    }
+
+    /**
+     * @brief Append a mapping key to an at_path path: after a '.', or as ["key"] when the key is
+     * empty or holds '.', '[', ']' or '"'. Inside the quotes, '"' and '\' get a backslash.
+     */
+    static void appendPathKey(std::string& path, std::string_view key) {
+        if (!key.empty() && key.find_first_of(".[]\"") == std::string_view::npos) {
+            if (!path.empty())
+                path += '.';
+            path += key;
+            return;
+        }
+        path += "[\"";
+        for (char c : key) {
+            if (c == '"' || c == '\\')
+                path += '\\';
+            path += c;
+        }
+        path += "\"]";
+    }
+
+    // ---- Access tracking ----
+
+    /**
+     * @brief Per-node read counter, kept in the node's attachment slots.
+     */
+    struct AccessCounter {
+        static constexpr bool kKeepOnClear = true; // Edits to a node do not undo its reads
+        mutable std::atomic<uint64_t> reads{0};
+        AccessCounter() = default;
+        AccessCounter(AccessCounter&& other) noexcept : reads(other.reads.load(std::memory_order_relaxed)) {}
+    };
+
+    /**
+     * @brief Count one read of node. NodeView lookups and ranges call this when built with
+     * BASIC_YAML_ACCESS_TRACKING=1; applications may call it for reads that bypass NodeView.
+     */
+    static void recordAccess(const YamlNode& node) {
+        node.attachment<AccessCounter>([](const YamlNode&) { return AccessCounter{}; })
+            .reads.fetch_add(1, std::memory_order_relaxed);
+    }
+    static uint64_t accessCount(const YamlNode& node) {
+        const AccessCounter* c = node.findAttachment<AccessCounter>();
+        return c ? c->reads.load(std::memory_order_relaxed) : 0;
+    }
+
+    struct AccessEntry {
+        std::string path; // In at_path form, e.g. "servers[2].host" or "labels[\"app.kubernetes.io/name\"]"
+        uint64_t reads = 0;
+    };
+
+    /**
+     * @brief Read counts for every node below a root, and the subtrees nothing has read.
+     */
+    struct AccessReport {
+        std::vector<AccessEntry> entries; // Every node except the root, in document order
+        std::vector<std::string> unread;  // Topmost unread paths; their descendants are unread too
+
+        /**
+         * @brief The n most-read paths, most reads first; ties stay in document order.
+         */
+        std::vector<AccessEntry> hottest(size_t n) const {
+            std::vector<AccessEntry> hot;
+            for (const AccessEntry& e : entries)
+                if (e.reads)
+                    hot.push_back(e);
+            std::stable_sort(hot.begin(), hot.end(),
+                             [](const AccessEntry& a, const AccessEntry& b) { return a.reads > b.reads; });
+            if (hot.size() > n)
+                hot.resize(n);
+            return hot;
+        }
+    };
+
+    static AccessReport accessReport(const YamlNode& root) {
+        AccessReport report;
+        std::string path;
+        std::vector<size_t> pathLength = {0}; // Length of path at each depth
+        std::vector<bool> readAt = {true};    // Whether the node at each depth was read; the root always is
+        traverse(root, [&](const YamlNode& n, const TraversalContext& ctx) {
+            if (ctx.depth == 0)
+                return true;
+            path.resize(pathLength[ctx.depth - 1]);
+            if (ctx.key) {
+                appendPathKey(path, *ctx.key);
+            } else {
+                path += '[';
+                path += std::to_string(ctx.index);
+                path += ']';
+            }
+            uint64_t reads = accessCount(n);
+            pathLength.resize(ctx.depth + 1);
+            readAt.resize(ctx.depth + 1);
+            pathLength[ctx.depth] = path.size();
+            readAt[ctx.depth] = reads != 0;
+            if (!reads && readAt[ctx.depth - 1])
+                report.unread.push_back(path);
+            report.entries.push_back(AccessEntry{path, reads});
+            return true;
+        });
+        return report;
+    }
+
+    /**
+     * @brief Print the `top` most-read paths with their counts, then every topmost unread path.
+     */
+    static void writeAccessReport(std::ostream& os, const YamlNode& root, size_t top = 20) {
+        AccessReport report = accessReport(root);
+        os << "hot paths:\n";
+        for (const AccessEntry& e : report.hottest(top))
+            os << "  " << e.reads << "\t" << e.path << "\n";
+        os << "never read:\n";
+        for (const std::string& p : report.unread)
+            os << "  " << p << "\n";
+    }
+
+    /**
+     * @brief Zero every read counter below and including root.
+     */
+    static void resetAccessCounts(const YamlNode& root) {
+        traverse(root, [](const YamlNode& n, const TraversalContext&) {
+            if (const AccessCounter* c = n.findAttachment<AccessCounter>())
+                c->reads.store(0, std::memory_order_relaxed);
+            return true;
+        });
+    }
+
+    // ---- Emission to YAML ----
+
+    /**
+     * @brief Emission target appending to a caller-owned std::string.
+     */
+    struct StringOutput {
+        std::string& buf;
+        void write(const char* p, size_t n) { buf.append(p, n); }
+        void put(char c) { buf.push_back(c); }
+    };
+
+    /**
+     * @brief Emission target that fills a fixed chunk buffer and hands each full chunk to a sink.
+     *
+     * Writes larger than the chunk go straight to the sink. Call flush() when done; the
+     * destructor flushes too, but swallows sink exceptions.
+     */
+    class SinkOutput {
+      public:
+        using Sink = std::function<void(const char*, size_t)>;
+
+        explicit SinkOutput(Sink sink, size_t chunkSize = 64 * 1024)
+            : sink_(std::move(sink)), buf_(new char[chunkSize]), cap_(chunkSize) {}
+        SinkOutput(const SinkOutput&) = delete;
+        SinkOutput& operator=(const SinkOutput&) = delete;
+        ~SinkOutput() {
+            try {
+                flush();
+            } catch (...) {
+            }
+        }
+
+        void write(const char* p, size_t n) {
+            if (n > cap_ - used_) {
+                flush();
+                if (n >= cap_) {
+                    sink_(p, n);
+                    written_ += n;
+                    return;
+                }
+            }
+            std::memcpy(buf_.get() + used_, p, n);
+            used_ += n;
+        }
+        void put(char c) {
+            if (used_ == cap_)
+                flush();
+            buf_[used_++] = c;
+        }
+        void flush() {
+            if (used_ == 0)
+                return;
+            size_t n = used_;
+            used_ = 0;
+            sink_(buf_.get(), n);
+            written_ += n;
+        }
+        size_t bytesWritten() const { return written_; } // Handed to the sink so far
+
+      private:
+        Sink sink_;
+        std::unique_ptr<char[]> buf_;
+        size_t cap_;
+        size_t used_ = 0;
+        size_t written_ = 0;
+    };
+
+    /**
+     * @brief Write n spaces from a static run of blanks (no per-node indent strings).
+     */
+    template <class Out> static void writeSpaces(Out& out, size_t n) {
+        static constexpr char kSpaces[] = "                                                                "
+                                          "                                                                ";
+        constexpr size_t kRun = sizeof(kSpaces) - 1;
+        while (n > kRun) {
+            out.write(kSpaces, kRun);
+            n -= kRun;
+        }
+        out.write(kSpaces, n);
+    }
+    template <class Out> static void writeStr(Out& out, std::string_view s) { out.write(s.data(), s.size()); }
+
+    /**
+     * @brief Write each line of text (split like std::getline) prefixed by `spaces` blanks.
+     *
+     * Empty lines are written without the indent.
+     */
+    template <class Out> static void writeIndentedLines(Out& out, std::string_view text, size_t spaces) {
+        size_t pos = 0;
+        while (pos < text.size()) {
+            const void* nl = std::memchr(text.data() + pos, '\n', text.size() - pos);
+            size_t end = nl ? static_cast<size_t>(static_cast<const char*>(nl) - text.data()) : text.size();
+            if (end > pos) {
+                writeSpaces(out, spaces);
+                out.write(text.data() + pos, end - pos);
+            }
+            out.put('\n');
+            pos = end + 1;
+        }
+    }
+
+    /**
+     * @brief Block header ("|", "|-", "|+", ">" or ">-") under which the parser reads node's value
+     * back unchanged, or an empty view if the value has to be quoted instead.
+     *
+     * The parser strips every line's leading blanks and skips leading blank lines, so literal
+     * blocks need lines that do not start with a blank. Folded blocks also need single-line
+     * paragraphs without edge blanks, at most one trailing newline and no empty paragraphs.
+     * A folded value that does not fit falls back to a literal block.
+     */
+    static std::string_view blockHeader(const YamlNode& node) {
+        std::string_view v = node.scalarValue;
+        size_t body = v.find_last_not_of('\n');
+        if (body == std::string_view::npos || v[0] == ' ' || v.find("\n ") != std::string_view::npos ||
+            (classifyScalar(v) & kScanControl))
+            return {};
+        size_t trailing = v.size() - body - 1;
+        std::string_view text = v.substr(0, body + 1);
+        if (text[0] == '\n')
+            return {};
+        if (node.style == ScalarStyle::Folded && trailing <= 1 && text.back() != ' ' &&
+            text.find("\n\n") == std::string_view::npos && text.find(" \n") == std::string_view::npos)
+            return trailing == 0 ? ">-" : ">";
+        return trailing == 0 ? "|-" : trailing == 1 ? "|" : "|+";
+    }
+
+    /**
+     * @brief Write the lines of a block scalar whose header blockHeader returned.
+     */
+    template <class Out>
+    static void writeBlockBody(Out& out, std::string_view v, std::string_view header, size_t spaces) {
+        if (header[0] == '|') {
+            writeIndentedLines(out, v, spaces);
+            return;
+        }
+        // Folded: one line per paragraph, paragraphs separated by a blank line.
+        std::string_view text = v.substr(0, v.find_last_not_of('\n') + 1);
+        size_t pos = 0;
+        while (pos <= text.size()) {
+            size_t end = std::min(text.find('\n', pos), text.size());
+            if (pos > 0)
+                out.put('\n');
+            writeSpaces(out, spaces);
+            out.write(text.data() + pos, end - pos);
+            out.put('\n');
+            pos = end + 1;
+        }
+    }
+
+    /**
+     * @brief True if node is written inline as [a, b] or {k: v}: empty, or at most 5 plain scalars
+     * that need no quoting inside a flow collection.
+     */
+    static bool emitsFlow(const YamlNode& node) {
+        auto flowSafe = [](const YamlNode& n) {
+            return n.type == YamlNodeType::Scalar && n.style == ScalarStyle::Plain &&
+                   !scalarNeedsQuotes(n.scalarValue, ScalarContext::Flow);
+        };
+        if (node.type == YamlNodeType::Sequence)
+            return node.sequence.size() <= 5 && std::all_of(node.sequence.begin(), node.sequence.end(), flowSafe);
+        return node.mapping.size() <= 5 && std::all_of(node.mapping.begin(), node.mapping.end(), [&](const auto& kv) {
+                   return flowSafe(kv.second) && !scalarNeedsQuotes(kv.first, ScalarContext::Flow);
+               });
+    }
+
+    /**
+     * @brief Write a collection accepted by emitsFlow on the current line.
+     */
+    template <class Out> static void writeFlow(Out& out, const YamlNode& node) {
+        if (node.type == YamlNodeType::Sequence) {
+            out.put('[');
+            for (size_t i = 0; i < node.sequence.size(); ++i) {
+                if (i > 0)
+                    out.write(", ", 2);
+                writeStr(out, node.sequence[i].scalarValue);
+            }
+            out.put(']');
+            return;
+        }
+        out.put('{');
+        bool first = true;
+        for (const auto& kv : node.mapping) {
+            if (!first)
+                out.write(", ", 2);
+            writeStr(out, kv.first);
+            out.write(": ", 2);
+            writeStr(out, kv.second.scalarValue);
+            first = false;
+        }
+        out.put('}');
+    }
+
+    /**
+     * @brief Emit one block-sequence item ("- value", or "-" followed by the nested collection).
+     *
+     * The parser has no block or flow scalars inside sequence items, so multi-line scalars are
+     * quoted and nested collections always use block style.
+     */
+    template <class Out> static void emitSeqItem(const YamlNode& item, Out& out, int indent) {
+        if (emitSeqItemHead(item, out, indent))
+            emitYamlTo(item, out, indent + 1);
+    }
+
+    // Write "- scalar", or the "-" line of a nested collection; true when the item's children must follow.
+    template <class Out> static bool emitSeqItemHead(const YamlNode& item, Out& out, int indent) {
+        writeSpaces(out, static_cast<size_t>(indent) * 2);
+        if (item.type == YamlNodeType::Scalar) {
+            out.write("- ", 2);
+            writeNodeScalar(out, item, ScalarContext::SeqItem);
+            out.put('\n');
+            return false;
+        }
+        out.write("-\n", 2);
+        return true;
+    }
+
+    /**
+     * @brief Emit one block-mapping entry: "key: value", "key: |" plus a block, "key: [a, b]", or
+     * "key:" followed by the nested collection.
+     */
+    template <class Out>
+    static void emitMapEntry(const std::pair<const std::string, YamlNode>& kv, Out& out, int indent) {
+        if (emitMapEntryHead(kv.first, kv.second, out, indent))
+            emitYamlTo(kv.second, out, indent + 1);
+    }
+
+    // Write a whole scalar or flow entry, or the "key:" line of a nested collection.
+    // Returns true when v's children must follow.
+    template <class Out> static bool emitMapEntryHead(const std::string& key, const YamlNode& v, Out& out, int indent) {
+        size_t ind = static_cast<size_t>(indent) * 2;
+        writeSpaces(out, ind);
+        writeScalar(out, key, ScalarContext::Key);
+        if (v.type == YamlNodeType::Scalar) {
+            if (isBlockStyle(v.style) && v.scalarValue.find('\n') != std::string::npos) {
+                std::string_view header = blockHeader(v);
+                if (!header.empty()) {
+                    out.write(": ", 2);
+                    writeStr(out, header);
+                    out.put('\n');
+                    writeBlockBody(out, v.scalarValue, header, ind + 2);
+                    return false;
+                }
+            }
+            out.write(": ", 2);
+            writeNodeScalar(out, v, ScalarContext::MapValue);
+            out.put('\n');
+            return false;
+        }
+        if (emitsFlow(v)) {
+            out.write(": ", 2);
+            writeFlow(out, v);
+            out.put('\n');
+            return false;
+        }
+        out.write(":\n", 2);
+        return true;
+    }
+
+    /**
+     * @brief Emit YAML into any target with write(const char*, size_t) and put(char).
+     *
+     * This is the emitter behind emitYaml and toYamlString. Its output re-parses to the same
+     * tree: scalars are quoted where the parser would misread them, and collections are written
+     * in flow style only where the parser accepts it (as a mapping value).
+     */
+    template <class Out> static void emitYamlTo(const YamlNode& node, Out& out, int indent = 0) {
+        traverse(node, [&out, indent](const YamlNode& n, const TraversalContext& ctx) {
+            if (ctx.depth == 0) {
+                if (n.type == YamlNodeType::Scalar) {
+                    writeSpaces(out, static_cast<size_t>(indent) * 2);
+                    writeNodeScalar(out, n, ScalarContext::MapValue);
+                }
+                return true;
+            }
+            int level = indent + static_cast<int>(ctx.depth) - 1;
+            return ctx.key ? emitMapEntryHead(*ctx.key, n, out, level) : emitSeqItemHead(n, out, level);
+        });
+    }
+
+    static void emitYaml(const YamlNode& node, std::ostream& os, int indent = 0) {
+        YAML_TRACE_SCOPE(trace, "emitYaml", 0);
+        SinkOutput out([&os](const char* p, size_t n) { os.write(p, static_cast<std::streamsize>(n)); });
+        emitYamlTo(node, out, indent);
+        out.flush();
+        YAML_TRACE_BYTES(trace, out.bytesWritten());
+    }
+    static std::string toYamlString(const YamlNode& node) {
+        YAML_TRACE_SCOPE(trace, "emitYaml", 0);
+        std::string buf;
+        StringOutput out{buf};
+        emitYamlTo(node, out, 0);
+        YAML_TRACE_BYTES(trace, buf.size());
+        return buf;
+    }
+
+    /**
+     * @brief Emission target that only counts bytes.
+     */
+    struct CountingOutput {
+        size_t size = 0;
+        void write(const char*, size_t n) { size += n; }
+        void put(char) { ++size; }
+    };
+
+    /**
+     * @brief Emission target writing into a caller-provided buffer; never allocates.
+     *
+     * Once the buffer is full further bytes are dropped but still counted, so `size` ends up
+     * as the space the complete output needs.
+     */
+    struct FixedOutput {
+        char* buf;
+        size_t cap;
+        size_t size = 0;
+        void write(const char* p, size_t n) {
+            if (size <= cap && n <= cap - size)
+                std::memcpy(buf + size, p, n);
+            size += n;
+        }
+        void put(char c) {
+            if (size < cap)
+                buf[size] = c;
+            ++size;
+        }
+        bool overflow() const { return size > cap; }
+    };
+
+    /**
+     * @brief Outcome of emitInto.
+     */
+    struct EmitResult {
+        size_t size = 0;       // Bytes written, or bytes required if the buffer was too small
+        bool overflow = false; // Buffer too small; its contents are then unspecified
+        explicit operator bool() const { return !overflow; }
+    };
+
+    /**
+     * @brief Exact number of bytes toYamlString(node) produces.
+     *
+     * Costs one extra tree walk. toYamlString itself does not use it: reserving up front
+     * measured slower than amortized growth. Pair it with emitInto to size a region exactly.
+     */
+    static size_t emittedSize(const YamlNode& node) {
+        CountingOutput out;
+        emitYamlTo(node, out, 0);
+        return out.size;
+    }
+
+    /**
+     * @brief Emit YAML into buf[0, cap) without any heap allocation. No terminating NUL is written.
+     *
+     * Documents nested more than 16 levels deep are the exception: traverse keeps deeper levels on the heap.
+     */
+    static EmitResult emitInto(const YamlNode& node, char* buf, size_t cap) {
+        FixedOutput out{buf, cap};
+        emitYamlTo(node, out, 0);
+        return EmitResult{out.size, out.overflow()};
+    }
+
+    // ---- Scalar classification and quoting ----
+
+    /**
+     * @brief Where a scalar is written; each position has its own characters the parser would misread.
+     */
+    enum class ScalarContext {
+        MapValue, // After "key: "
+        SeqItem,  // After "- "; any ':' would turn the item into a mapping
+        Key,      // Before ':'; any ':' or a leading '-' is misread
+        Flow      // Inside [...] or {...}; ',' and brackets split or end the collection
+    };
+
+    // Bits returned by classifyScalar.
+    static constexpr unsigned kScanControl = 1u << 0;     // Byte < 0x20 other than '\n', or 0x7f
+    static constexpr unsigned kScanNewline = 1u << 1;     // '\n'
+    static constexpr unsigned kScanHash = 1u << 2;        // '#'
+    static constexpr unsigned kScanColon = 1u << 3;       // ':'
+    static constexpr unsigned kScanColonSpace = 1u << 4;  // ": "
+    static constexpr unsigned kScanEscape = 1u << 5;      // '"' or '\\'
+    static constexpr unsigned kScanFlow = 1u << 6;        // ',', '[', ']', '{', '}'
+    static constexpr unsigned kScanQuote = 1u << 7;       // '"' or '\''
+
+    static constexpr std::array<uint8_t, 256> makeScanTable() {
+        std::array<uint8_t, 256> t{};
+        for (int c = 0; c < 0x20; ++c)
+            t[c] = kScanControl;
+        t[0x7f] = kScanControl;
+        t['\n'] = kScanNewline;
+        t['#'] = kScanHash;
+        t[':'] = kScanColon;
+        t['"'] = kScanEscape | kScanQuote;
+        t['\\'] = kScanEscape;
+        t['\''] = kScanQuote;
+        t[','] = t['['] = t[']'] = t['{'] = t['}'] = kScanFlow;
+        return t;
+    }
+
+    /**
+     * @brief OR of the kScan* bits for every byte of s that can force quoting or escaping.
+     *
+     * Clean runs are skipped 16 bytes at a time with SSE2 (one compare per special byte, one
+     * movemask); only the rare bytes that hit are looked up individually. The tail is covered
+     * by one overlapping block, and strings shorter than a block are copied into one. Without
+     * SSE2 the same lookup table is applied byte by byte.
+     */
+    static unsigned classifyScalar(std::string_view s) {
+        static constexpr std::array<uint8_t, 256> kTable = makeScanTable();
+        const char* p = s.data();
+        size_t n = s.size();
+        unsigned bits = 0;
+        auto classifyAt = [&](size_t i) {
+            unsigned b = kTable[static_cast<unsigned char>(p[i])];
+            if ((b & kScanColon) && i + 1 < n && p[i + 1] == ' ')
+                b |= kScanColonSpace;
+            bits |= b;
+        };
+#if defined(__SSE2__)
+        // Visit every byte of the 16 at block (which holds p[base, base + 16)) that may be special.
+        auto scanBlock = [&](const char* block, size_t base, unsigned valid) {
+            __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(block));
+            __m128i hit = _mm_cmpeq_epi8(_mm_min_epu8(v, _mm_set1_epi8(0x1f)), v); // v <= 0x1f
+            hit = _mm_or_si128(hit, _mm_cmpeq_epi8(v, _mm_set1_epi8(0x7f)));
+            hit = _mm_or_si128(hit, _mm_cmpeq_epi8(v, _mm_set1_epi8('#')));
+            hit = _mm_or_si128(hit, _mm_cmpeq_epi8(v, _mm_set1_epi8(':')));
+            hit = _mm_or_si128(hit, _mm_cmpeq_epi8(v, _mm_set1_epi8('"')));
+            hit = _mm_or_si128(hit, _mm_cmpeq_epi8(v, _mm_set1_epi8('\'')));
+            hit = _mm_or_si128(hit, _mm_cmpeq_epi8(v, _mm_set1_epi8('\\')));
+            hit = _mm_or_si128(hit, _mm_cmpeq_epi8(v, _mm_set1_epi8(',')));
+            // '[' 0x5b / '{' 0x7b and ']' 0x5d / '}' 0x7d differ only in bit 5: fold it away.
+            __m128i bracket = _mm_or_si128(v, _mm_set1_epi8(0x20));
+            hit = _mm_or_si128(hit, _mm_cmpeq_epi8(bracket, _mm_set1_epi8(0x7b)));
+            hit = _mm_or_si128(hit, _mm_cmpeq_epi8(bracket, _mm_set1_epi8(0x7d)));
+            unsigned mask = static_cast<unsigned>(_mm_movemask_epi8(hit)) & valid;
+            while (mask) {
+                classifyAt(base + static_cast<size_t>(__builtin_ctz(mask)));
+                mask &= mask - 1;
+            }
+        };
+        if (n < 16) {
+            char block[16] = {};
+            std::memcpy(block, p, n);
+            scanBlock(block, 0, (1u << n) - 1);
+            return bits;
+        }
+        size_t i = 0;
+        for (; i + 16 <= n; i += 16)
+            scanBlock(p + i, i, 0xffff);
+        if (i < n)
+            scanBlock(p + n - 16, n - 16, 0xffff); // Overlaps bytes already seen; bits just OR again
+#else
+        for (size_t i = 0; i < n; ++i)
+            classifyAt(i);
+#endif
+        return bits;
+    }
+
+    /**
+     * @brief Index of the first byte in p[0, n) that writeQuoted must escape, or n if there is none.
+     */
+    static size_t findEscapeByte(const char* p, size_t n) {
+        size_t i = 0;
+#if defined(__SSE2__)
+        const __m128i below = _mm_set1_epi8(0x1f);
+        for (; i + 16 <= n; i += 16) {
+            __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p + i));
+            __m128i hit = _mm_cmpeq_epi8(_mm_min_epu8(v, below), v);
+            hit = _mm_or_si128(hit, _mm_cmpeq_epi8(v, _mm_set1_epi8(0x7f)));
+            hit = _mm_or_si128(hit, _mm_cmpeq_epi8(v, _mm_set1_epi8('"')));
+            hit = _mm_or_si128(hit, _mm_cmpeq_epi8(v, _mm_set1_epi8('\\')));
+            if (int mask = _mm_movemask_epi8(hit))
+                return i + static_cast<size_t>(__builtin_ctz(static_cast<unsigned>(mask)));
+        }
+#endif
+        for (; i < n; ++i) {
+            unsigned char c = static_cast<unsigned char>(p[i]);
+            if (c < 0x20 || c == 0x7f || c == '"' || c == '\\')
+                return i;
+        }
+        return n;
+    }
+
+    /**
+     * @brief True if s cannot be written as a plain scalar in ctx and read back unchanged.
+     *
+     * Catches empty strings, leading/trailing blanks, leading indicators, "- " and ": ",
+     * comments and any control character, plus the context-specific cases of ScalarContext.
+     */
+    static bool scalarNeedsQuotes(std::string_view s, ScalarContext ctx = ScalarContext::MapValue) {
+        if (s.empty() || s.front() == ' ' || s.back() == ' ' || s.back() == ':')
+            return true;
+        switch (s.front()) {
+        case '?':
+        case ':':
+        case ',':
+        case '[':
+        case ']':
+        case '{':
+        case '}':
+        case '&':
+        case '*':
+        case '!':
+        case '|':
+        case '>':
+        case '\'':
+        case '"':
+        case '%':
+        case '@':
+        case '`':
+            return true;
+        case '-':
+            if (s.size() == 1 || s[1] == ' ' || ctx == ScalarContext::Key)
+                return true;
+            break;
+        default:
+            break;
+        }
+        unsigned bits = classifyScalar(s);
+        if (bits & (kScanControl | kScanNewline | kScanHash | kScanColonSpace))
+            return true;
+        if ((bits & kScanColon) && ctx != ScalarContext::MapValue)
+            return true;
+        // A quote inside a key could pair up with one in the value when comments are stripped.
+        if ((bits & kScanQuote) && ctx == ScalarContext::Key)
+            return true;
+        return (bits & kScanFlow) && ctx == ScalarContext::Flow;
+    }
+
+    /**
+     * @brief Write s as a double-quoted scalar, escaping quotes, backslashes and control characters.
+     *
+     * Runs between escapes are copied with a single write.
+     */
+    template <class Out> static void writeQuoted(Out& out, std::string_view s) {
+        static constexpr char kHex[] = "0123456789abcdef";
+        out.put('"');
+        size_t i = 0;
+        while (i < s.size()) {
+            size_t j = i + findEscapeByte(s.data() + i, s.size() - i);
+            out.write(s.data() + i, j - i);
+            if (j == s.size())
+                break;
+            unsigned char c = static_cast<unsigned char>(s[j]);
+            switch (c) {
+            case '"':
+                out.write("\\\"", 2);
+                break;
+            case '\\':
+                out.write("\\\\", 2);
+                break;
+            case '\n':
+                out.write("\\n", 2);
+                break;
+            case '\t':
+                out.write("\\t", 2);
+                break;
+            case '\r':
+                out.write("\\r", 2);
+                break;
+            default: {
+                char esc[4] = {'\\', 'x', kHex[c >> 4], kHex[c & 0xf]};
+                out.write(esc, 4);
+            } break;
+            }
+            i = j + 1;
+        }
+        out.put('"');
+    }
+
+    /**
+     * @brief Write s plain if that round-trips in ctx, double-quoted otherwise.
+     */
+    template <class Out>
+    static void writeScalar(Out& out, std::string_view s, ScalarContext ctx = ScalarContext::MapValue) {
+        if (scalarNeedsQuotes(s, ctx))
+            writeQuoted(out, s);
+        else
+            out.write(s.data(), s.size());
+    }
+
+    static bool isBlockStyle(ScalarStyle style) { return style == ScalarStyle::Literal || style == ScalarStyle::Folded; }
+
+    /**
+     * @brief True if plain s reads as a number, boolean or null rather than as text.
+     */
+    static bool hasTypedReading(std::string_view s) {
+        CountingOutput discard;
+        return writeJsonTyped(discard, s);
+    }
+
+    /**
+     * @brief writeScalar for a node; a Quoted scalar that would read back as a number, boolean or
+     * null keeps its quotes.
+     */
+    template <class Out> static void writeNodeScalar(Out& out, const YamlNode& n, ScalarContext ctx) {
+        if (n.style == ScalarStyle::Quoted && hasTypedReading(n.scalarValue))
+            writeQuoted(out, n.scalarValue);
+        else
+            writeScalar(out, n.scalarValue, ctx);
+    }
+
+    /**
+     * @brief Incremental block-style YAML writer that streams to a sink without building a tree.
+     *
+     * Only a stack of open containers (one small frame per nesting level) is kept. Strings are
+     * quoted when needed; numbers are formatted with std::to_chars.
+     *
+     *     YamlWriter w(sink);
+     *     w.beginMap();
+     *     w.key("name").value("api");
+     *     w.key("ports").beginSeq().value(80).value(443).end();
+     *     w.end();
+     *     w.finish();
+     */
+    class YamlWriter {
+      public:
+        explicit YamlWriter(SinkOutput::Sink sink, size_t chunkSize = 64 * 1024) : out_(std::move(sink), chunkSize) {}
+        explicit YamlWriter(std::string& buf)
+            : out_([&buf](const char* p, size_t n) { buf.append(p, n); }, 4096) {}
+        YamlWriter(const YamlWriter&) = delete;
+        YamlWriter& operator=(const YamlWriter&) = delete;
+
+        YamlWriter& beginMap() { return begin(true); }
+        YamlWriter& beginSeq() { return begin(false); }
+
+        /**
+         * @brief Close the innermost container. Empty containers are written as {} or [].
+         */
+        YamlWriter& end() {
+            if (stack_.empty())
+                throw YamlError("YamlWriter: end() without an open container");
+            Frame f = stack_.back();
+            if (f.isMap && f.keyPending)
+                throw YamlError("YamlWriter: key without a value");
+            stack_.pop_back();
+            if (!f.open) {
+                writeStr(out_, f.isMap ? (f.headerPending ? " {}\n" : "{}\n") : (f.headerPending ? " []\n" : "[]\n"));
+            }
+            return *this;
+        }
+
+        YamlWriter& key(std::string_view k) {
+            if (stack_.empty() || !stack_.back().isMap || stack_.back().keyPending)
+                throw YamlError("YamlWriter: key() is only valid inside a mapping, before its value");
+            openTop();
+            writeSpaces(out_, stack_.back().indent);
+            writeScalar(out_, k, ScalarContext::Key);
+            out_.put(':');
+            stack_.back().keyPending = true;
+            return *this;
+        }
+
+        YamlWriter& value(std::string_view s) {
+            writeScalar(out_, s, startScalar());
+            out_.put('\n');
+            return *this;
+        }
+        YamlWriter& value(const std::string& s) { return value(std::string_view(s)); }
+        YamlWriter& value(const char* s) { return value(std::string_view(s)); }
+        YamlWriter& value(bool b) {
+            startScalar();
+            writeStr(out_, b ? "true\n" : "false\n");
+            return *this;
+        }
+        YamlWriter& value(double d) {
+            startScalar();
+            char buf[32];
+            auto res = std::to_chars(buf, buf + sizeof(buf), d);
+            out_.write(buf, static_cast<size_t>(res.ptr - buf));
+            out_.put('\n');
+            return *this;
+        }
+        template <class T, std::enable_if_t<std::is_integral_v<T> && !std::is_same_v<T, bool>, int> = 0>
+        YamlWriter& value(T i) {
+            startScalar();
+            char buf[24];
+            auto res = std::to_chars(buf, buf + sizeof(buf), i);
+            out_.write(buf, static_cast<size_t>(res.ptr - buf));
+            out_.put('\n');
+            return *this;
+        }
+        YamlWriter& null() {
+            startScalar();
+            writeStr(out_, "null\n");
+            return *this;
+        }
+
+        /**
+         * @brief Flush buffered output.
+         * @throws YamlError if containers are still open.
+         */
+        void finish() {
+            if (!stack_.empty())
+                throw YamlError("YamlWriter: finish() with open containers");
+            out_.flush();
+        }
+
+        size_t depth() const { return stack_.size(); }
+
+      private:
+        struct Frame {
+            bool isMap;
+            bool open = false;          // Header written and at least one child emitted
+            bool headerPending = false; // "key:" or "-" written, newline not yet
+            bool keyPending = false;    // Map: key written, waiting for its value
+            size_t indent = 0;          // Indent of this container's children
+        };
+
+        // Position the cursor for a child of the innermost container.
+        void openTop() {
+            if (stack_.empty())
+                return;
+            Frame& f = stack_.back();
+            if (!f.open) {
+                if (f.headerPending)
+                    out_.put('\n');
+                f.open = true;
+            }
+        }
+
+        // Write whatever precedes a scalar or a nested container: "- " in a sequence, " " after a key.
+        // Returns the indent children of a nested container would use.
+        size_t prefix(bool forContainer) {
+            if (stack_.empty()) {
+                if (rootDone_)
+                    throw YamlError("YamlWriter: document already has a root value");
+                rootDone_ = true;
+                return 0;
+            }
+            Frame& f = stack_.back();
+            if (f.isMap) {
+                if (!f.keyPending)
+                    throw YamlError("YamlWriter: value without a key");
+                f.keyPending = false;
+                if (!forContainer)
+                    out_.put(' ');
+                return f.indent + 2;
+            }
+            openTop();
+            writeSpaces(out_, f.indent);
+            out_.write(forContainer ? "-" : "- ", forContainer ? 1 : 2);
+            return f.indent + 2;
+        }
+
+        // Returns the context the scalar is written in.
+        ScalarContext startScalar() {
+            bool inSeq = !stack_.empty() && !stack_.back().isMap;
+            prefix(false);
+            return inSeq ? ScalarContext::SeqItem : ScalarContext::MapValue;
+        }
+
+        YamlWriter& begin(bool isMap) {
+            bool nested = !stack_.empty();
+            size_t indent = prefix(true);
+            Frame f{isMap};
+            f.indent = indent;
+            f.headerPending = nested;
+            stack_.push_back(f);
+            return *this;
+        }
+
+        SinkOutput out_;
+        std::vector<Frame> stack_;
+        bool rootDone_ = false;
+    };
+
+    /**
+     * @brief Emit to a sink in large chunks, without materializing the whole output.
+     */
+    static void emitYaml(const YamlNode& node, const SinkOutput::Sink& sink, size_t chunkSize = 64 * 1024) {
+        YAML_TRACE_SCOPE(trace, "emitYaml", 0);
+        SinkOutput out(sink, chunkSize);
+        emitYamlTo(node, out, 0);
+        out.flush();
+        YAML_TRACE_BYTES(trace, out.bytesWritten());
+    }
+
+    // ---- Parallel emission ----
+
+    /**
+     * @brief Run fn(i) for every i in [0, n) on up to `threads` threads, including the caller.
+     *
+     * Indices are handed out dynamically so uneven items balance out. The first exception thrown
+     * by fn stops further indices from starting and is rethrown after all threads have joined.
+     */
+    template <class F> static void parallelFor(size_t n, size_t threads, F&& fn) {
+        threads = std::min(threads, n);
+        if (threads <= 1) {
+            for (size_t i = 0; i < n; ++i)
+                fn(i);
+            return;
+        }
+        std::atomic<size_t> next{0};
+        std::atomic<bool> stop{false};
+        std::mutex errorMutex;
+        std::exception_ptr error;
+        auto work = [&] {
+            for (size_t i; !stop.load(std::memory_order_relaxed) && (i = next.fetch_add(1)) < n;) {
+                try {
+                    fn(i);
+                } catch (...) {
+                    std::lock_guard<std::mutex> lock(errorMutex);
+                    if (!error)
+                        error = std::current_exception();
+                    stop.store(true, std::memory_order_relaxed);
+                }
+            }
+        };
+        std::vector<std::thread> pool;
+        pool.reserve(threads - 1);
+        for (size_t t = 1; t < threads; ++t)
+            pool.emplace_back(work);
+        work();
+        for (auto& th : pool)
+            th.join();
+        if (error)
+            std::rethrow_exception(error);
+    }
+
+    /**
+     * @brief Stable sort of v on up to `threads` threads: sort equal slices, then merge neighbours pairwise.
+     */
+    template <class T, class Less> static void parallelStableSort(std::vector<T>& v, size_t threads, Less less) {
+        const size_t slices = std::min(threads, v.size() / 4096);
+        if (slices <= 1) {
+            std::stable_sort(v.begin(), v.end(), less);
+            return;
+        }
+        std::vector<size_t> bounds(slices + 1);
+        for (size_t i = 0; i <= slices; ++i)
+            bounds[i] = v.size() * i / slices;
+        auto at = [&](size_t slice) { return v.begin() + static_cast<std::ptrdiff_t>(bounds[slice]); };
+        parallelFor(slices, threads, [&](size_t s) { std::stable_sort(at(s), at(s + 1), less); });
+        for (size_t width = 1; width < slices; width *= 2) {
+            parallelFor((slices + 2 * width - 1) / (2 * width), threads, [&](size_t pair) {
+                size_t lo = pair * 2 * width;
+                size_t mid = std::min(lo + width, slices), hi = std::min(lo + 2 * width, slices);
+                if (mid < hi)
+                    std::inplace_merge(at(lo), at(mid), at(hi), less);
+            });
+        }
+    }
+
+    /**
+     * @brief Call fn(size_t index, NodeView element) for every element of a sequence on up to `threads` threads.
+     *
+     * Elements are handed out in blocks of `grain` so cheap callbacks are not dominated by
+     * scheduling. Does nothing unless seq is a sequence. Exceptions propagate as for parallelFor.
+     */
+    template <class F>
+    static void forEachElementParallel(NodeView seq, size_t threads, F&& fn, size_t grain = 256) {
+        const size_t n = seq.elements().size();
+        grain = std::max<size_t>(grain, 1);
+        parallelFor((n + grain - 1) / grain, threads, [&](size_t b) {
+            const size_t end = std::min(n, (b + 1) * grain);
+            for (size_t i = b * grain; i < end; ++i)
+                fn(i, NodeView{&seq.n->sequence[i]});
+        });
+    }
+
+    /**
+     * @brief Call fn(std::string_view key, NodeView value) for every entry of a mapping on up to `threads` threads.
+     *
+     * Mapping entries are not randomly accessible, so this first collects one pointer per entry.
+     */
+    template <class F>
+    static void forEachItemParallel(NodeView map, size_t threads, F&& fn, size_t grain = 256) {
+        std::vector<const std::pair<const std::string, YamlNode>*> entries;
+        if (map.is_map()) {
+            entries.reserve(map.n->mapping.size());
+            for (const auto& kv : map.n->mapping)
+                entries.push_back(&kv);
+        }
+        grain = std::max<size_t>(grain, 1);
+        parallelFor((entries.size() + grain - 1) / grain, threads, [&](size_t b) {
+            const size_t end = std::min(entries.size(), (b + 1) * grain);
+            for (size_t i = b * grain; i < end; ++i)
+                fn(std::string_view(entries[i]->first), NodeView{&entries[i]->second});
+        });
+    }
+
+    /**
+     * @brief Emit node's top-level entries in parallel, handing the output to consume(std::string&) in order.
+     *
+     * Consecutive root entries (mapping keys or sequence items) are grouped into chunks, each
+     * chunk is emitted into its own buffer, and the buffers are consumed in document order, so
+     * the concatenation is byte-identical to emitYamlTo. Chunks are produced in waves of a few
+     * per thread, which bounds the memory held in buffers. Scalar roots and roots with only a
+     * handful of entries are emitted serially as one chunk.
+     */
+    template <class F> static void emitParallelChunks(const YamlNode& node, size_t threads, F&& consume) {
+        if (threads == 0)
+            threads = std::max(1u, std::thread::hardware_concurrency());
+        size_t n = node.type == YamlNodeType::Mapping    ? node.mapping.size()
+                   : node.type == YamlNodeType::Sequence ? node.sequence.size()
+                                                         : 0;
+        if (threads <= 1 || n <= 5) {
+            std::string buf;
+            StringOutput out{buf};
+            emitYamlTo(node, out, 0);
+            consume(buf);
+            return;
+        }
+        std::vector<const std::pair<const std::string, YamlNode>*> entries;
+        if (node.type == YamlNodeType::Mapping) {
+            entries.reserve(n);
+            for (const auto& kv : node.mapping)
+                entries.push_back(&kv);
+        }
+        size_t perChunk = std::min<size_t>(1024, std::max<size_t>(1, n / (threads * 4)));
+        size_t chunks = (n + perChunk - 1) / perChunk;
+        size_t wave = threads * 2;
+        std::vector<std::string> bufs(std::min(wave, chunks));
+        for (size_t first = 0; first < chunks; first += wave) {
+            size_t count = std::min(wave, chunks - first);
+            parallelFor(count, threads, [&](size_t c) {
+                YAML_TRACE_SCOPE(trace, "emitYaml chunk", 0);
+                std::string& buf = bufs[c];
+                buf.clear();
+                StringOutput out{buf};
+                size_t begin = (first + c) * perChunk, end = std::min(n, begin + perChunk);
+                for (size_t i = begin; i < end; ++i) {
+                    if (node.type == YamlNodeType::Mapping)
+                        emitMapEntry(*entries[i], out, 0);
+                    else
+                        emitSeqItem(node.sequence[i], out, 0);
+                }
+                YAML_TRACE_BYTES(trace, buf.size());
+            });
+            for (size_t c = 0; c < count; ++c)
+                consume(bufs[c]);
+        }
+    }
+
+    /**
+     * @brief toYamlString, with the top-level entries emitted on `threads` threads (0 = hardware concurrency).
+     */
+    static std::string toYamlStringParallel(const YamlNode& node, size_t threads = 0) {
+        std::string result;
+        emitParallelChunks(node, threads, [&](std::string& chunk) {
+            if (result.empty())
+                result.swap(chunk);
+            else
+                result += chunk;
+        });
+        return result;
+    }
+
+    /**
+     * @brief Emit to a sink, with the top-level entries emitted on `threads` threads (0 = hardware concurrency).
+     *
+     * The sink receives one call per chunk, in document order, from the calling thread.
+     */
+    static void emitYamlParallel(const YamlNode& node, const SinkOutput::Sink& sink, size_t threads = 0) {
+        emitParallelChunks(node, threads, [&](std::string& chunk) {
+            if (!chunk.empty())
+                sink(chunk.data(), chunk.size());
+        });
+    }
+
+    // ---- Emission to JSON ----
+
+    /**
+     * @brief Layout and typing of JSON output.
+     */
+    struct JsonOptions {
+        bool pretty = false;     // Newlines and indentation; compact otherwise
+        int indent = 2;          // Spaces per level when pretty
+        bool typedScalars = true; // Plain scalars that read as numbers, booleans or null are written bare
+    };
+
+    /**
+     * @brief True if s is already a valid JSON number: -?(0|[1-9][0-9]*)(.[0-9]+)?([eE][+-]?[0-9]+)?
+     */
+    static bool isJsonNumber(std::string_view s) {
+        size_t i = 0, n = s.size();
+        auto digits = [&] {
+            size_t start = i;
+            while (i < n && s[i] >= '0' && s[i] <= '9')
+                ++i;
+            return i > start;
+        };
+        if (i < n && s[i] == '-')
+            ++i;
+        if (i < n && s[i] == '0')
+            ++i;
+        else if (!digits())
+            return false;
+        if (i < n && s[i] == '.') {
+            ++i;
+            if (!digits())
+                return false;
+        }
+        if (i < n && (s[i] == 'e' || s[i] == 'E')) {
+            ++i;
+            if (i < n && (s[i] == '+' || s[i] == '-'))
+                ++i;
+            if (!digits())
+                return false;
+        }
+        return i == n;
+    }
+
+    /**
+     * @brief Write a plain scalar as a bare JSON literal if it has a typed reading; false if it is a string.
+     *
+     * Valid JSON numbers are copied through. Other YAML numbers ("+5", "007", ".5", "1.") are
+     * re-formatted with std::to_chars; booleans and nulls follow deduceType.
+     */
+    template <class Out> static bool writeJsonTyped(Out& out, std::string_view s) {
+        if (s.empty() || s == "~" || iequals(s, "null")) {
+            out.write("null", 4);
+            return true;
+        }
+        char c = s[0];
+        if ((c >= '0' && c <= '9') || c == '-' || c == '+' || c == '.') {
+            if (isJsonNumber(s)) {
+                out.write(s.data(), s.size());
+                return true;
+            }
+            const char* b = s.data() + (c == '+' ? 1 : 0);
+            const char* e = s.data() + s.size();
+            char buf[32];
+            long long i = 0;
+            if (auto r = std::from_chars(b, e, i); r.ec == std::errc{} && r.ptr == e) {
+                auto w = std::to_chars(buf, buf + sizeof(buf), i);
+                out.write(buf, static_cast<size_t>(w.ptr - buf));
+                return true;
+            }
+            double d = 0;
+            if (auto r = std::from_chars(b, e, d); r.ec == std::errc{} && r.ptr == e && std::isfinite(d)) {
+                auto w = std::to_chars(buf, buf + sizeof(buf), d);
+                out.write(buf, static_cast<size_t>(w.ptr - buf));
+                return true;
+            }
+            return false;
+        }
+        if (iequals(s, "true") || iequals(s, "yes") || iequals(s, "on")) {
+            out.write("true", 4);
+            return true;
+        }
+        if (iequals(s, "false") || iequals(s, "no") || iequals(s, "off")) {
+            out.write("false", 5);
+            return true;
+        }
+        return false;
+    }
+
+    /**
+     * @brief Write s as a JSON string. Runs without escapes are found with findEscapeByte and copied whole.
+     */
+    template <class Out> static void writeJsonString(Out& out, std::string_view s) {
+        static constexpr char kHex[] = "0123456789abcdef";
+        out.put('"');
+        size_t i = 0;
+        while (i < s.size()) {
+            size_t j = i + findEscapeByte(s.data() + i, s.size() - i);
+            out.write(s.data() + i, j - i);
+            if (j == s.size())
+                break;
+            unsigned char c = static_cast<unsigned char>(s[j]);
+            switch (c) {
+            case '"':
+                out.write("\\\"", 2);
+                break;
+            case '\\':
+                out.write("\\\\", 2);
+                break;
+            case '\n':
+                out.write("\\n", 2);
+                break;
+            case '\t':
+                out.write("\\t", 2);
+                break;
+            case '\r':
+                out.write("\\r", 2);
+                break;
+            case '\b':
+                out.write("\\b", 2);
+                break;
+            case '\f':
+                out.write("\\f", 2);
+                break;
+            default: {
+                char esc[6] = {'\\', 'u', '0', '0', kHex[c >> 4], kHex[c & 0xf]};
+                out.write(esc, 6);
+            } break;
+            }
+            i = j + 1;
+        }
+        out.put('"');
+    }
+
+    /**
+     * @brief Emit node as JSON into any target with write(const char*, size_t) and put(char).
+     */
+    template <class Out>
+    static void emitJsonTo(const YamlNode& node, Out& out, const JsonOptions& opts, int depth = 0) {
+        auto newline = [&](size_t level) {
+            if (opts.pretty) {
+                out.put('\n');
+                writeSpaces(out, (static_cast<size_t>(depth) + level) * static_cast<size_t>(opts.indent));
+            }
+        };
+        auto pre = [&](const YamlNode& n, const TraversalContext& ctx) {
+            if (ctx.depth > 0) {
+                if (ctx.index > 0)
+                    out.put(',');
+                newline(ctx.depth);
+                if (ctx.key) {
+                    writeJsonString(out, *ctx.key);
+                    out.write(": ", opts.pretty ? 2 : 1);
+                }
+            }
+            switch (n.type) {
+            case YamlNodeType::Scalar:
+                if (!(opts.typedScalars && n.style == ScalarStyle::Plain && writeJsonTyped(out, n.scalarValue)))
+                    writeJsonString(out, n.scalarValue);
+                return false;
+            case YamlNodeType::Sequence:
+                out.put('[');
+                return true;
+            case YamlNodeType::Mapping:
+                out.put('{');
+                return true;
+            }
+            return false;
+        };
+        auto post = [&](const YamlNode& n, const TraversalContext& ctx) {
+            if (n.type == YamlNodeType::Scalar)
+                return;
+            if (!n.sequence.empty() || !n.mapping.empty())
+                newline(ctx.depth);
+            out.put(n.type == YamlNodeType::Sequence ? ']' : '}');
+        };
+        traverse(node, pre, post);
+    }
+
+    static std::string toJsonString(const YamlNode& node, const JsonOptions& opts) {
+        YAML_TRACE_SCOPE(trace, "emitJson", 0);
+        std::string buf;
+        StringOutput out{buf};
+        emitJsonTo(node, out, opts);
+        YAML_TRACE_BYTES(trace, buf.size());
+        return buf;
+    }
+    static std::string toJsonString(const YamlNode& node) { return toJsonString(node, JsonOptions{}); }
+
+    /**
+     * @brief Stream JSON to a sink in chunkSize pieces without materializing the whole output.
+     */
+    static void emitJson(const YamlNode& node, const SinkOutput::Sink& sink, const JsonOptions& opts,
+                         size_t chunkSize = 64 * 1024) {
+        YAML_TRACE_SCOPE(trace, "emitJson", 0);
+        SinkOutput out(sink, chunkSize);
+        emitJsonTo(node, out, opts);
+        out.flush();
+        YAML_TRACE_BYTES(trace, out.bytesWritten());
+    }
+    static void emitJson(const YamlNode& node, std::ostream& os, const JsonOptions& opts) {
+        emitJson(node, [&os](const char* p, size_t n) { os.write(p, static_cast<std::streamsize>(n)); }, opts);
+    }
+    static void emitJson(const YamlNode& node, std::ostream& os) { emitJson(node, os, JsonOptions{}); }
+
+    // ---- JSON parsing ----
+
+    /**
+     * @brief Parse JSON text into the same YamlNode structure the YAML parser builds.
+     *
+     * Objects become mappings (a repeated key keeps its last value), arrays become sequences.
+     * Numbers keep their source text, and true/false/null become the plain scalars "true",
+     * "false" and "null". Strings are unescaped, including \uXXXX surrogate pairs, which are
+     * written as UTF-8, and marked ScalarStyle::Quoted so "42" stays a string. String
+     * bodies are scanned for quotes and backslashes with findEscapeByte.
+     *
+     * @throws YamlError with line and column on malformed input.
+     */
+    static YamlNode parseJson(std::string_view text) {
+        JsonReader reader(text);
+        YamlNode root;
+        reader.skipSpace();
+        reader.parseValue(root, 0);
+        reader.skipSpace();
+        if (!reader.atEnd())
+            reader.fail("Unexpected data after JSON value");
+        return root;
+    }
+
+    /**
+     * @brief True if the first non-blank byte of text opens a JSON object or array.
+     */
+    static bool looksLikeJson(std::string_view text) {
+        size_t first = text.find_first_not_of(" \t\r\n");
+        return first != std::string_view::npos && (text[first] == '{' || text[first] == '[');
+    }
+
+  private:
+    /**
+     * @brief Single-pass recursive-descent JSON reader behind parseJson.
+     */
+    class JsonReader {
+      public:
+        static constexpr int kMaxDepth = 512;
+
+        explicit JsonReader(std::string_view text) : text_(text), p_(text.data()), end_(text.data() + text.size()) {}
+
+        bool atEnd() const { return p_ == end_; }
+
+        void skipSpace() {
+            while (p_ < end_ && (*p_ == ' ' || *p_ == '\n' || *p_ == '\r' || *p_ == '\t'))
+                ++p_;
+        }
+
+        [[noreturn]] void fail(const std::string& msg) const {
+            int line = 1, col = 1;
+            for (const char* q = text_.data(); q < p_; ++q) {
+                if (*q == '\n') {
+                    ++line;
+                    col = 1;
+                } else {
+                    ++col;
+                }
+            }
+            throw YamlError("JSON: " + msg, line, col);
+        }
+
+        void parseValue(YamlNode& out, int depth) {
+            if (p_ == end_)
+                fail("Unexpected end of input");
+            switch (*p_) {
+            case '{':
+                parseObject(out, depth);
+                break;
+            case '[':
+                parseArray(out, depth);
+                break;
+            case '"':
+                out.type = YamlNodeType::Scalar;
+                out.style = ScalarStyle::Quoted;
+                parseString(out.scalarValue);
+                break;
+            case 't':
+                literal(out, "true");
+                break;
+            case 'f':
+                literal(out, "false");
+                break;
+            case 'n':
+                literal(out, "null");
+                break;
+            default:
+                parseNumber(out);
+                break;
+            }
+        }
+
+      private:
+        void expect(char c) {
+            if (p_ == end_ || *p_ != c)
+                fail(std::string("Expected '") + c + "'");
+            ++p_;
+        }
+
+        void enter(int depth) {
+            if (depth >= kMaxDepth)
+                fail("Nesting too deep");
+        }
+
+        void parseObject(YamlNode& out, int depth) {
+            enter(depth);
+            out.type = YamlNodeType::Mapping;
+            ++p_;
+            skipSpace();
+            if (p_ < end_ && *p_ == '}') {
+                ++p_;
+                return;
+            }
+            std::string key;
+            for (;;) {
+                skipSpace();
+                if (p_ == end_ || *p_ != '"')
+                    fail("Expected string key");
+                key.clear();
+                parseString(key);
+                skipSpace();
+                expect(':');
+                skipSpace();
+                // Hinted at the end: O(1) when keys arrive sorted, as our emitter writes them
+                size_t before = out.mapping.size();
+                auto it = out.mapping.try_emplace(out.mapping.end(), std::move(key));
+                if (out.mapping.size() == before)
+                    it->second = YamlNode(); // Repeated key: the last value wins
+                parseValue(it->second, depth + 1);
+                skipSpace();
+                if (p_ < end_ && *p_ == ',') {
+                    ++p_;
+                    continue;
+                }
+                expect('}');
+                return;
+            }
+        }
+
+        void parseArray(YamlNode& out, int depth) {
+            enter(depth);
+            out.type = YamlNodeType::Sequence;
+            ++p_;
+            skipSpace();
+            if (p_ < end_ && *p_ == ']') {
+                ++p_;
+                return;
+            }
+            for (;;) {
+                skipSpace();
+                out.sequence.emplace_back();
+                parseValue(out.sequence.back(), depth + 1);
+                skipSpace();
+                if (p_ < end_ && *p_ == ',') {
+                    ++p_;
+                    continue;
+                }
+                expect(']');
+                return;
+            }
+        }
+
+        void parseString(std::string& out) {
+            ++p_; // Opening quote
+            for (;;) {
+                const char* stop = p_ + findEscapeByte(p_, static_cast<size_t>(end_ - p_));
+                out.append(p_, stop);
+                p_ = stop;
+                if (p_ == end_)
+                    fail("Unterminated string");
+                char c = *p_;
+                if (c == '"') {
+                    ++p_;
+                    return;
+                }
+                if (c == 0x7f) { // Stops findEscapeByte but is valid JSON text
+                    out.push_back(c);
+                    ++p_;
+                    continue;
+                }
+                if (c != '\\')
+                    fail("Control character in string");
+                if (++p_ == end_)
+                    fail("Unterminated string");
+                switch (*p_++) {
+                case '"':
+                    out.push_back('"');
+                    break;
+                case '\\':
+                    out.push_back('\\');
+                    break;
+                case '/':
+                    out.push_back('/');
+                    break;
+                case 'b':
+                    out.push_back('\b');
+                    break;
+                case 'f':
+                    out.push_back('\f');
+                    break;
+                case 'n':
+                    out.push_back('\n');
+                    break;
+                case 'r':
+                    out.push_back('\r');
+                    break;
+                case 't':
+                    out.push_back('\t');
+                    break;
+                case 'u':
+                    appendUtf8(out, parseCodePoint());
+                    break;
+                default:
+                    --p_;
+                    fail("Invalid escape");
+                }
+            }
+        }
+
+        unsigned hex4() {
+            if (end_ - p_ < 4)
+                fail("Truncated \\u escape");
+            unsigned v = 0;
+            for (int i = 0; i < 4; ++i, ++p_) {
+                char c = *p_;
+                v <<= 4;
+                if (c >= '0' && c <= '9')
+                    v |= static_cast<unsigned>(c - '0');
+                else if (c >= 'a' && c <= 'f')
+                    v |= static_cast<unsigned>(c - 'a' + 10);
+                else if (c >= 'A' && c <= 'F')
+                    v |= static_cast<unsigned>(c - 'A' + 10);
+                else
+                    fail("Invalid \\u escape");
+            }
+            return v;
+        }
+
+        // After "\u": one code unit, or a surrogate pair combined into one code point.
+        unsigned parseCodePoint() {
+            unsigned cp = hex4();
+            if (cp >= 0xd800 && cp <= 0xdbff && end_ - p_ >= 6 && p_[0] == '\\' && p_[1] == 'u') {
+                const char* save = p_;
+                p_ += 2;
+                unsigned lo = hex4();
+                if (lo >= 0xdc00 && lo <= 0xdfff)
+                    return 0x10000 + ((cp - 0xd800) << 10) + (lo - 0xdc00);
+                p_ = save;
+            }
+            return cp;
+        }
+
+        static void appendUtf8(std::string& out, unsigned cp) {
+            if (cp < 0x80) {
+                out.push_back(static_cast<char>(cp));
+            } else if (cp < 0x800) {
+                out.push_back(static_cast<char>(0xc0 | (cp >> 6)));
+                out.push_back(static_cast<char>(0x80 | (cp & 0x3f)));
+            } else if (cp < 0x10000) {
+                out.push_back(static_cast<char>(0xe0 | (cp >> 12)));
+                out.push_back(static_cast<char>(0x80 | ((cp >> 6) & 0x3f)));
+                out.push_back(static_cast<char>(0x80 | (cp & 0x3f)));
+            } else {
+                out.push_back(static_cast<char>(0xf0 | (cp >> 18)));
+                out.push_back(static_cast<char>(0x80 | ((cp >> 12) & 0x3f)));
+                out.push_back(static_cast<char>(0x80 | ((cp >> 6) & 0x3f)));
+                out.push_back(static_cast<char>(0x80 | (cp & 0x3f)));
+            }
+        }
+
+        void literal(YamlNode& out, std::string_view word) {
+            if (static_cast<size_t>(end_ - p_) < word.size() || std::string_view(p_, word.size()) != word)
+                fail("Invalid literal");
+            out.type = YamlNodeType::Scalar;
+            out.scalarValue.assign(word.data(), word.size());
+            p_ += word.size();
+        }
+
+        // Validates the JSON number grammar and keeps the source text.
+        void parseNumber(YamlNode& out) {
+            const char* start = p_;
+            auto digits = [&] {
+                const char* d = p_;
+                while (p_ < end_ && *p_ >= '0' && *p_ <= '9')
+                    ++p_;
+                return p_ > d;
+            };
+            if (p_ < end_ && *p_ == '-')
+                ++p_;
+            if (p_ < end_ && *p_ == '0')
+                ++p_;
+            else if (!digits())
+                fail("Unexpected character");
+            if (p_ < end_ && *p_ == '.') {
+                ++p_;
+                if (!digits())
+                    fail("Digits expected after '.'");
+            }
+            if (p_ < end_ && (*p_ == 'e' || *p_ == 'E')) {
+                ++p_;
+                if (p_ < end_ && (*p_ == '+' || *p_ == '-'))
+                    ++p_;
+                if (!digits())
+                    fail("Digits expected in exponent");
+            }
+            out.type = YamlNodeType::Scalar;
+            out.scalarValue.assign(start, p_);
+        }
+
+        std::string_view text_;
+        const char* p_;
+        const char* end_;
+    };
+
+  public:
+    // ---- Event streaming and YAML-to-JSON transcoding ----
+
+    /**
+     * @brief Parse a YAML stream into events for handler without building a tree.
+     *
+     * Handler provides beginDocument(), endDocument(), beginMap(), beginSeq(), end(),
+     * key(std::string_view) and scalar(std::string_view, ScalarStyle). Documents are separated
+     * by "---" / "..." lines at column 0; documents without content produce no events. Keys come
+     * in document order. Only a stack of open collections (plus the current line or block
+     * scalar) is held, so memory follows nesting depth, not document size. The input is read
+     * line by line and never rewound, so pipes work.
+     *
+     * The accepted syntax is the line parser's, except that "- key: value" opens a mapping item
+     * whose following, more indented keys join it.
+     *
+     * @throws YamlError on malformed input, after the events for everything before it.
+     */
+    template <class Handler> static void parseEvents(std::istream& input, Handler& handler) {
+        EventParser<Handler>(input, handler).run();
+    }
+
+    /**
+     * @brief Event handler writing one compact JSON value per document, each followed by '\n' (NDJSON).
+     *
+     * Keeps one frame per open collection. Plain scalars are typed as in toJsonString.
+     */
+    template <class Out> class JsonEventWriter {
+      public:
+        explicit JsonEventWriter(Out& out, bool typedScalars = true) : out_(out), typed_(typedScalars) {}
+
+        void beginDocument() {
+            stack_.clear();
+            afterKey_ = false;
+        }
+        void endDocument() { out_.put('\n'); }
+        void beginMap() { open('{', '}'); }
+        void beginSeq() { open('[', ']'); }
+        void end() {
+            out_.put(stack_.back().close);
+            stack_.pop_back();
+        }
+        void key(std::string_view k) {
+            separate();
+            writeJsonString(out_, k);
+            out_.put(':');
+            afterKey_ = true;
+        }
+        void scalar(std::string_view v, ScalarStyle style) {
+            separate();
+            if (!(typed_ && style == ScalarStyle::Plain && writeJsonTyped(out_, v)))
+                writeJsonString(out_, v);
+        }
+
+      private:
+        struct Frame {
+            char close;
+            bool first;
+        };
+
+        void separate() {
+            if (afterKey_) {
+                afterKey_ = false;
+            } else if (!stack_.empty()) {
+                if (!stack_.back().first)
+                    out_.put(',');
+                stack_.back().first = false;
+            }
+        }
+        void open(char c, char close) {
+            separate();
+            out_.put(c);
+            stack_.push_back(Frame{close, true});
+        }
+
+        Out& out_;
+        bool typed_;
+        bool afterKey_ = false;
+        std::vector<Frame> stack_;
+    };
+
+    /**
+     * @brief Convert a (multi-document) YAML stream to NDJSON on the fly: one JSON line per document.
+     * @return The number of documents written.
+     */
+    static size_t transcodeToNdjson(std::istream& input, const SinkOutput::Sink& sink, size_t chunkSize = 64 * 1024) {
+        SinkOutput out(sink, chunkSize);
+        struct Counting : JsonEventWriter<SinkOutput> {
+            using JsonEventWriter<SinkOutput>::JsonEventWriter;
+            size_t documents = 0;
+            void endDocument() {
+                JsonEventWriter<SinkOutput>::endDocument();
+                ++documents;
+            }
+        } writer(out);
+        parseEvents(input, writer);
+        out.flush();
+        return writer.documents;
+    }
+
+    /**
+     * @brief Event handler that builds a YamlNode tree; the inverse of walking a tree into events.
+     */
+    class NodeBuilder {
+      public:
+        YamlNode root;
+
+        void beginDocument() {
+            root = YamlNode();
+            stack_.clear();
+        }
+        void endDocument() {}
+        void beginMap() { stack_.push_back(&open(YamlNodeType::Mapping)); }
+        void beginSeq() { stack_.push_back(&open(YamlNodeType::Sequence)); }
+        void end() { stack_.pop_back(); }
+        void key(std::string_view k) { key_.assign(k.data(), k.size()); }
+        void scalar(std::string_view v, ScalarStyle style) {
+            YamlNode& n = open(YamlNodeType::Scalar);
+            n.style = style;
+            n.scalarValue.assign(v.data(), v.size());
+        }
+
+      private:
+        // The node the next value goes into: the root, a new sequence element, or the value of key_.
+        YamlNode& open(YamlNodeType type) {
+            YamlNode* slot = &root;
+            if (!stack_.empty()) {
+                YamlNode& top = *stack_.back();
+                if (top.type == YamlNodeType::Sequence) {
+                    slot = &top.sequence.emplace_back();
+                } else {
+                    size_t before = top.mapping.size();
+                    slot = &top.mapping.try_emplace(top.mapping.end(), key_)->second;
+                    if (top.mapping.size() == before)
+                        *slot = YamlNode(); // Repeated key: the last value wins
+                }
+            }
+            slot->type = type;
+            return *slot;
+        }
+
+        std::vector<YamlNode*> stack_;
+        std::string key_;
+    };
+
+    // ---- MessagePack interchange ----
+
+    // Ext type carrying a block scalar: one style byte ('|' or '>') followed by the text.
+    static constexpr int8_t kMsgPackBlockScalarExt = 1;
+
+    /**
+     * @brief Encode node as MessagePack into any target with write(const char*, size_t) and put(char).
+     *
+     * Mappings and sequences become maps and arrays. A plain scalar becomes nil, a boolean, an
+     * integer or a float64 only when decoding gives back exactly the same text ("null", "true",
+     * "42", "0.5", but not "030" or "1.50"); anything else, and every Quoted scalar, is a string.
+     * Decoding marks a string with such a canonical reading Quoted again. Literal and folded
+     * scalars use ext type kMsgPackBlockScalarExt, so their style survives.
+     */
+    template <class Out> static void encodeMsgPackTo(const YamlNode& node, Out& out) {
+        traverse(node, [&out](const YamlNode& n, const TraversalContext& ctx) {
+            if (ctx.key)
+                writeMsgPackStr(out, *ctx.key);
+            switch (n.type) {
+            case YamlNodeType::Scalar:
+                if (isBlockStyle(n.style)) {
+                    writeMsgPackHeader(out, n.scalarValue.size() + 1, 0, 0xc7, 0xc8, 0xc9);
+                    out.put(static_cast<char>(kMsgPackBlockScalarExt));
+                    out.put(n.style == ScalarStyle::Literal ? '|' : '>');
+                    writeStr(out, n.scalarValue);
+                } else if (n.style == ScalarStyle::Quoted || !writeMsgPackTyped(out, n.scalarValue)) {
+                    writeMsgPackStr(out, n.scalarValue);
+                }
+                return false;
+            case YamlNodeType::Sequence:
+                writeMsgPackHeader(out, n.sequence.size(), 0x90, 0, 0xdc, 0xdd);
+                return true;
+            case YamlNodeType::Mapping:
+                writeMsgPackHeader(out, n.mapping.size(), 0x80, 0, 0xde, 0xdf);
+                return true;
+            }
+            return false;
+        });
+    }
+
+    static std::string toMsgPack(const YamlNode& node) {
+        std::string buf;
+        StringOutput out{buf};
+        encodeMsgPackTo(node, out);
+        return buf;
+    }
+
+    /**
+     * @brief Stream MessagePack to a sink in chunkSize pieces.
+     */
+    static void encodeMsgPack(const YamlNode& node, const SinkOutput::Sink& sink, size_t chunkSize = 64 * 1024) {
+        SinkOutput out(sink, chunkSize);
+        encodeMsgPackTo(node, out);
+        out.flush();
+    }
+
+    /**
+     * @brief Decode one MessagePack value from data into events for handler (see parseEvents).
+     *
+     * Strings, map keys and block scalars are passed as string_views into data, so nothing is
+     * copied unless the handler copies it. Numbers, booleans and nil are formatted into a small
+     * stack buffer. Binary values decode as strings; other ext types are rejected.
+     *
+     * @return Bytes consumed, so several concatenated values can be decoded in turn.
+     * @throws YamlError on truncated or malformed input.
+     */
+    template <class Handler> static size_t decodeMsgPack(std::string_view data, Handler& handler) {
+        MsgPackDecoder<Handler> decoder(data, handler);
+        handler.beginDocument();
+        decoder.value(0);
+        handler.endDocument();
+        return decoder.consumed();
+    }
+
+    /**
+     * @brief Decode one MessagePack value into a tree.
+     * @throws YamlError on malformed input or trailing bytes.
+     */
+    static YamlNode fromMsgPack(std::string_view data) {
+        NodeBuilder builder;
+        if (decodeMsgPack(data, builder) != data.size())
+            throw YamlError("MessagePack: trailing bytes after value");
+        return std::move(builder.root);
+    }
+
+    // ---- Columnar extraction ----
+
+    enum class ColumnType { Int, Double, Bool, String };
+
+    /**
+     * @brief One column to extract: a path inside each record (as for NodeView::at_path) and its type.
+     */
+    struct ColumnSpec {
+        std::string path;
+        ColumnType type = ColumnType::String;
+    };
+
+    /**
+     * @brief Contiguous values of one field across all records.
+     *
+     * Only the vector matching type is filled. Strings are dictionary-encoded: codes[row] indexes
+     * dictionary, which holds each distinct value once, in first-seen order. A row is null when the
+     * field is missing or does not convert to the column's type; its validity bit is clear and its
+     * value slot is zero.
+     */
+    struct Column {
+        std::string path;
+        ColumnType type = ColumnType::String;
+        std::vector<long long> ints;
+        std::vector<double> doubles;
+        std::vector<uint8_t> bools;
+        std::vector<uint32_t> codes;
+        std::vector<std::string> dictionary;
+        std::vector<uint64_t> validity; // Bit (row % 64) of word (row / 64)
+        size_t nullCount = 0;
+
+        bool isValid(size_t row) const { return (validity[row >> 6] >> (row & 63)) & 1; }
+        const std::string& str(size_t row) const { return dictionary[codes[row]]; }
+    };
+
+    struct ColumnTable {
+        size_t rows = 0;
+        std::vector<Column> columns; // In ColumnSpec order
+
+        const Column& at(std::string_view path) const {
+            for (const auto& c : columns)
+                if (c.path == path)
+                    return c;
+            throw YamlError("YAML: no column '" + std::string(path) + "'");
+        }
+    };
+
+    /**
+     * @brief Extract typed columns from a sequence of mappings in a single pass over the records.
+     *
+     * With threads > 1, blocks of rows are filled concurrently and their string dictionaries are
+     * merged in row order afterwards. The result is identical to the serial one.
+     *
+     * @throws YamlError if records is not a sequence or a path is malformed.
+     */
+    static ColumnTable extractColumns(const YamlNode& records, const std::vector<ColumnSpec>& specs,
+                                      size_t threads = 1) {
+        if (records.type != YamlNodeType::Sequence)
+            throw YamlError("YAML: extractColumns expects a sequence of records");
+        const size_t rows = records.sequence.size();
+        const size_t cols = specs.size();
+        ColumnTable table;
+        table.rows = rows;
+        std::vector<std::vector<PathSegment>> paths;
+        for (const auto& spec : specs) {
+            Column& c = table.columns.emplace_back();
+            c.path = spec.path;
+            c.type = spec.type;
+            switch (spec.type) {
+            case ColumnType::Int: c.ints.resize(rows); break;
+            case ColumnType::Double: c.doubles.resize(rows); break;
+            case ColumnType::Bool: c.bools.resize(rows); break;
+            case ColumnType::String: c.codes.resize(rows); break;
+            }
+            c.validity.assign((rows + 63) / 64, 0);
+            paths.push_back(parseColumnPath(spec.path));
+        }
+
+        // Blocks are a multiple of 64 rows, so no two blocks write the same validity word.
+        constexpr size_t kBlockRows = 16 * 1024;
+        const size_t blocks = (rows + kBlockRows - 1) / kBlockRows;
+        struct Block {
+            std::vector<size_t> nulls;
+            std::vector<std::vector<std::string_view>> dicts; // Block-local dictionaries, first-seen order
+        };
+        std::vector<Block> state(blocks);
+        parallelFor(blocks, threads, [&](size_t b) {
+            Block& blk = state[b];
+            blk.nulls.assign(cols, 0);
+            blk.dicts.resize(cols);
+            std::vector<std::unordered_map<std::string_view, uint32_t>> index(cols);
+            const size_t end = std::min(rows, (b + 1) * kBlockRows);
+            for (size_t r = b * kBlockRows; r < end; ++r) {
+                const YamlNode& rec = records.sequence[r];
+                for (size_t c = 0; c < cols; ++c) {
+                    Column& col = table.columns[c];
+                    const YamlNode* v = resolveColumnPath(rec, paths[c]);
+                    if (v && fillColumnCell(col, r, *v, blk.dicts[c], index[c]))
+                        col.validity[r >> 6] |= uint64_t{1} << (r & 63);
+                    else
+                        ++blk.nulls[c];
+                }
+            }
+        });
+
+        for (size_t c = 0; c < cols; ++c) {
+            Column& col = table.columns[c];
+            for (const auto& blk : state)
+                col.nullCount += blk.nulls[c];
+            if (col.type != ColumnType::String)
+                continue;
+            // Map each block's local codes to global ones, keeping first-seen order across blocks.
+            std::unordered_map<std::string_view, uint32_t> global;
+            std::vector<std::vector<uint32_t>> remap(blocks);
+            for (size_t b = 0; b < blocks; ++b) {
+                for (std::string_view s : state[b].dicts[c]) {
+                    auto [it, inserted] = global.try_emplace(s, static_cast<uint32_t>(col.dictionary.size()));
+                    if (inserted)
+                        col.dictionary.emplace_back(s);
+                    remap[b].push_back(it->second);
+                }
+            }
+            if (blocks > 1) {
+                parallelFor(blocks, threads, [&](size_t b) {
+                    const size_t end = std::min(rows, (b + 1) * kBlockRows);
+                    for (size_t r = b * kBlockRows; r < end; ++r)
+                        if (col.isValid(r))
+                            col.codes[r] = remap[b][col.codes[r]];
+                });
+            }
+        }
+        return table;
+    }
+
+    // ---- Queries over sequences ----
+
+    /**
+     * @brief One group of an aggregating query.
+     */
+    struct QueryGroup {
+        std::string key;
+        bool missing = false; // The group_by value was missing, null or not a scalar; key is then empty
+        size_t count = 0;     // Elements in the group
+        double value = 0; // The aggregate: count, sum, avg, min or max; NaN when no element was numeric
+    };
+
+    struct QueryResult {
+        bool aggregated = false;
+        std::vector<NodeView> rows;     // Matching elements, in pipeline order, when !aggregated
+        std::vector<QueryGroup> groups; // Sorted by key, missing last; without group_by one group, key empty
+    };
+
+    /**
+     * @brief A compiled yq-style pipeline over the elements of a sequence.
+     *
+     * Stages are separated by '|':
+     *  - `select(.path OP literal)`, where OP is one of == != < <= > >= and the literal is a number,
+     *    a "string", true, false or null. Numbers compare numerically, everything else as text.
+     *  - `sort_by(.path)`: stable; numbers first, then strings, then missing values.
+     *  - `reverse`, `limit(N)`.
+     *  - `group_by(.path)`, which must be followed by an aggregate. Rows whose value there is
+     *    missing, null or not a scalar share one group marked `missing`.
+     *  - `count`, `sum(.path)`, `avg(.path)`, `min(.path)`, `max(.path)`, which end the pipeline.
+     *
+     * For example `select(.status >= 500) | group_by(.host) | count`. Paths use NodeView::at_path
+     * syntax after the leading '.'; `.` alone is the element itself. Leading selects run while
+     * scanning, so only matching elements are collected, and groups are aggregated by hashing.
+     * Each row's value at a select path is resolved and converted once for all selects reading it.
+     */
+    class Query {
+      public:
+        /**
+         * @throws YamlError on a syntax error.
+         */
+        static Query compile(std::string_view expr) {
+            Query q;
+            QueryCompiler c{expr};
+            do {
+                q.stages_.push_back(c.stage());
+            } while (c.eat('|'));
+            c.skipSpace();
+            if (c.i != expr.size())
+                c.fail("unexpected '" + std::string(1, expr[c.i]) + "'");
+            for (size_t s = 0; s < q.stages_.size(); ++s) {
+                Kind k = q.stages_[s].kind;
+                bool isAggregate = k >= Kind::Count;
+                bool last = s + 1 == q.stages_.size();
+                if (isAggregate && !last)
+                    c.fail("an aggregate must be the last stage");
+                if (k == Kind::GroupBy && (last || q.stages_[s + 1].kind < Kind::Count))
+                    c.fail("group_by must be followed by an aggregate");
+                if (k == Kind::Select)
+                    q.addSelectPath(q.stages_[s]);
+            }
+            return q;
+        }
+
+        /**
+         * @brief Run the pipeline over seq's elements; threads > 1 parallelizes scanning and sorting.
+         * @throws YamlError if seq is not a sequence.
+         */
+        QueryResult run(NodeView seq, size_t threads = 1) const {
+            if (!seq.is_seq())
+                throw YamlError("query: input is not a sequence");
+            const auto& items = seq.n->sequence;
+            size_t s = 0;
+            while (s < stages_.size() && stages_[s].kind == Kind::Select)
+                ++s;
+
+            // Scan in blocks, applying the leading selects, then concatenate the blocks in order.
+            constexpr size_t kBlock = 16 * 1024;
+            std::vector<std::vector<const YamlNode*>> blocks((items.size() + kBlock - 1) / kBlock);
+            parallelFor(blocks.size(), threads, [&](size_t b) {
+                std::vector<TypedValue> typed(selectPaths_.size());
+                size_t end = std::min(items.size(), (b + 1) * kBlock);
+                for (size_t i = b * kBlock; i < end; ++i)
+                    if (passes(items[i], 0, s, typed))
+                        blocks[b].push_back(&items[i]);
+            });
+            std::vector<const YamlNode*> rows;
+            for (auto& blk : blocks)
+                rows.insert(rows.end(), blk.begin(), blk.end());
+            blocks.clear();
+
+            QueryResult result;
+            const Stage* groupBy = nullptr;
+            std::vector<TypedValue> typed(selectPaths_.size());
+            for (; s < stages_.size(); ++s) {
+                const Stage& st = stages_[s];
+                switch (st.kind) {
+                case Kind::Select: {
+                    size_t first = s;
+                    while (s + 1 < stages_.size() && stages_[s + 1].kind == Kind::Select)
+                        ++s;
+                    rows.erase(std::remove_if(rows.begin(), rows.end(),
+                                              [&](const YamlNode* r) { return !passes(*r, first, s + 1, typed); }),
+                               rows.end());
+                    break;
+                }
+                case Kind::SortBy:
+                    sortRows(rows, st, threads);
+                    break;
+                case Kind::Reverse:
+                    std::reverse(rows.begin(), rows.end());
+                    break;
+                case Kind::Limit:
+                    if (rows.size() > st.limit)
+                        rows.resize(st.limit);
+                    break;
+                case Kind::GroupBy:
+                    groupBy = &st;
+                    break;
+                default:
+                    result.aggregated = true;
+                    result.groups = aggregate(rows, groupBy, st);
+                    return result;
+                }
+            }
+            result.rows.reserve(rows.size());
+            for (const YamlNode* r : rows)
+                result.rows.push_back(NodeView{r});
+            return result;
+        }
+
+      private:
+        // Aggregates come last, so `kind >= Kind::Count` identifies them.
+        enum class Kind { Select, SortBy, Reverse, Limit, GroupBy, Count, Sum, Avg, Min, Max };
+        enum class Cmp { Eq, Ne, Lt, Le, Gt, Ge };
+        enum class LiteralKind { Null, Bool, Number, String };
+
+        struct Stage {
+            Kind kind = Kind::Select;
+            std::vector<PathSegment> path;
+            Cmp cmp = Cmp::Eq;
+            LiteralKind literal = LiteralKind::Null; // The select literal, typed once at compile time
+            double number = 0;
+            bool boolean = false;
+            std::string text;
+            size_t limit = 0;
+            size_t slot = 0; // Select: index of its path in selectPaths_
+        };
+
+        // A distinct path read by select stages, and the conversions those stages need.
+        struct SelectPath {
+            std::vector<PathSegment> path;
+            bool number = false;
+            bool boolean = false;
+        };
+
+        // One row's value at a SelectPath, resolved and converted once for every select reading it.
+        struct TypedValue {
+            bool ready = false;
+            bool null = true; // Missing, or a null scalar
+            bool scalar = false;
+            std::string_view text;
+            std::optional<double> number;
+            std::optional<bool> boolean;
+        };
+
+        // Recursive-descent reader for compile(); i is the offset into expr.
+        struct QueryCompiler {
+            std::string_view expr;
+            size_t i = 0;
+
+            [[noreturn]] void fail(const std::string& msg) const {
+                throw YamlError("query: " + msg + " at offset " + std::to_string(i));
+            }
+            void skipSpace() {
+                while (i < expr.size() && std::isspace(static_cast<unsigned char>(expr[i])))
+                    ++i;
+            }
+            bool eat(char c) {
+                skipSpace();
+                if (i < expr.size() && expr[i] == c) {
+                    ++i;
+                    return true;
+                }
+                return false;
+            }
+            void expect(char c) {
+                if (!eat(c))
+                    fail(std::string("expected '") + c + "'");
+            }
+            std::string_view word() {
+                skipSpace();
+                size_t start = i;
+                while (i < expr.size() && (std::isalnum(static_cast<unsigned char>(expr[i])) || expr[i] == '_'))
+                    ++i;
+                return expr.substr(start, i - start);
+            }
+            std::vector<PathSegment> path() {
+                skipSpace();
+                if (i >= expr.size() || expr[i] != '.')
+                    fail("expected a path starting with '.'");
+                size_t start = ++i;
+                while (i < expr.size() && !std::isspace(static_cast<unsigned char>(expr[i])) &&
+                       std::string_view("=!<>)|").find(expr[i]) == std::string_view::npos) {
+                    if (expr[i++] != '"')
+                        continue;
+                    while (i < expr.size() && expr[i] != '"') // A quoted key may hold any of the stop characters
+                        i += expr[i] == '\\' ? 2 : 1;
+                    if (i < expr.size())
+                        ++i;
+                }
+                i = std::min(i, expr.size());
+                return parseColumnPath(expr.substr(start, i - start));
+            }
+            Cmp comparison() {
+                skipSpace();
+                std::string_view rest = expr.substr(i);
+                static constexpr std::pair<std::string_view, Cmp> ops[] = {{"==", Cmp::Eq}, {"!=", Cmp::Ne},
+                                                                           {"<=", Cmp::Le}, {">=", Cmp::Ge},
+                                                                           {"<", Cmp::Lt},  {">", Cmp::Gt}};
+                for (const auto& [text, op] : ops) {
+                    if (rest.substr(0, text.size()) == text) {
+                        i += text.size();
+                        return op;
+                    }
+                }
+                fail("expected a comparison operator");
+            }
+            void literal(Stage& st) {
+                skipSpace();
+                if (eat('"')) {
+                    for (; i < expr.size() && expr[i] != '"'; ++i) {
+                        if (expr[i] == '\\' && i + 1 < expr.size())
+                            ++i;
+                        st.text.push_back(expr[i]);
+                    }
+                    expect('"');
+                    st.literal = LiteralKind::String;
+                    return;
+                }
+                size_t start = i;
+                while (i < expr.size() && expr[i] != ')' && !std::isspace(static_cast<unsigned char>(expr[i])))
+                    ++i;
+                std::string_view tok = expr.substr(start, i - start);
+                const char* e = tok.data() + tok.size();
+                if (tok == "null") {
+                    st.literal = LiteralKind::Null;
+                } else if (tok == "true" || tok == "false") {
+                    st.literal = LiteralKind::Bool;
+                    st.boolean = tok == "true";
+                } else if (auto r = std::from_chars(tok.data(), e, st.number); !tok.empty() && r.ptr == e) {
+                    st.literal = LiteralKind::Number;
+                } else {
+                    fail("expected a literal");
+                }
+            }
+            Stage stage() {
+                Stage st;
+                std::string_view name = word();
+                static constexpr std::pair<std::string_view, Kind> kinds[] = {
+                    {"select", Kind::Select}, {"sort_by", Kind::SortBy}, {"reverse", Kind::Reverse},
+                    {"limit", Kind::Limit},   {"group_by", Kind::GroupBy}, {"count", Kind::Count},
+                    {"sum", Kind::Sum},       {"avg", Kind::Avg},       {"min", Kind::Min},
+                    {"max", Kind::Max}};
+                auto found = std::find_if(std::begin(kinds), std::end(kinds),
+                                          [&](const auto& k) { return k.first == name; });
+                if (found == std::end(kinds))
+                    fail(name.empty() ? "expected a stage" : "unknown stage '" + std::string(name) + "'");
+                st.kind = found->second;
+                if (st.kind == Kind::Reverse || st.kind == Kind::Count)
+                    return st;
+                expect('(');
+                if (st.kind == Kind::Limit) {
+                    skipSpace();
+                    auto r = std::from_chars(expr.data() + i, expr.data() + expr.size(), st.limit);
+                    if (r.ec != std::errc{})
+                        fail("expected a row count");
+                    i = static_cast<size_t>(r.ptr - expr.data());
+                } else {
+                    st.path = path();
+                    if (st.kind == Kind::Select) {
+                        st.cmp = comparison();
+                        literal(st);
+                    }
+                }
+                expect(')');
+                return st;
+            }
+        };
+
+        // Missing, or a plain empty, ~ or null scalar. A quoted "null" is text.
+        static bool isNullScalar(const YamlNode* v) {
+            return !v || (v->type == YamlNodeType::Scalar && v->style != ScalarStyle::Quoted &&
+                          (v->scalarValue.empty() || v->scalarValue == "~" || iequals(v->scalarValue, "null")));
+        }
+
+        // Give st a slot in selectPaths_, shared with earlier selects on the same path.
+        void addSelectPath(Stage& st) {
+            auto same = [&](const SelectPath& sp) {
+                return std::equal(sp.path.begin(), sp.path.end(), st.path.begin(), st.path.end(),
+                                  [](const PathSegment& a, const PathSegment& b) {
+                                      return a.isIndex == b.isIndex && a.index == b.index && a.key == b.key;
+                                  });
+            };
+            auto found = std::find_if(selectPaths_.begin(), selectPaths_.end(), same);
+            st.slot = static_cast<size_t>(found - selectPaths_.begin());
+            if (found == selectPaths_.end())
+                selectPaths_.push_back(SelectPath{st.path});
+            selectPaths_[st.slot].number |= st.literal == LiteralKind::Number;
+            selectPaths_[st.slot].boolean |= st.literal == LiteralKind::Bool;
+        }
+
+        // Apply the selects stages_[first, last) to rec, typing each path they read at most once.
+        bool passes(const YamlNode& rec, size_t first, size_t last, std::vector<TypedValue>& typed) const {
+            for (TypedValue& t : typed)
+                t.ready = false;
+            for (size_t f = first; f < last; ++f) {
+                const Stage& st = stages_[f];
+                TypedValue& t = typed[st.slot];
+                if (!t.ready)
+                    t = typeValue(rec, selectPaths_[st.slot]);
+                if (!matches(t, st))
+                    return false;
+            }
+            return true;
+        }
+
+        static TypedValue typeValue(const YamlNode& rec, const SelectPath& sp) {
+            TypedValue t;
+            t.ready = true;
+            const YamlNode* v = resolveColumnPath(rec, sp.path);
+            t.null = isNullScalar(v);
+            if (t.null || v->type != YamlNodeType::Scalar)
+                return t;
+            t.scalar = true;
+            t.text = v->scalarValue;
+            if (sp.number)
+                t.number = toDouble(*v);
+            if (sp.boolean)
+                t.boolean = toBool(*v);
+            return t;
+        }
+
+        static bool matches(const TypedValue& v, const Stage& st) {
+            std::optional<int> order; // <0, 0, >0; empty when the value and literal are incomparable
+            if (st.literal == LiteralKind::Null) {
+                order = v.null ? 0 : 1;
+            } else if (v.scalar) {
+                if (st.literal == LiteralKind::Number) {
+                    if (v.number)
+                        order = (*v.number > st.number) - (*v.number < st.number);
+                } else if (st.literal == LiteralKind::Bool) {
+                    if (v.boolean)
+                        order = int(*v.boolean) - int(st.boolean);
+                } else {
+                    order = v.text.compare(st.text);
+                }
+            }
+            if (!order)
+                return st.cmp == Cmp::Ne;
+            if (st.literal == LiteralKind::Null && st.cmp != Cmp::Eq && st.cmp != Cmp::Ne)
+                return false;
+            switch (st.cmp) {
+            case Cmp::Eq: return *order == 0;
+            case Cmp::Ne: return *order != 0;
+            case Cmp::Lt: return *order < 0;
+            case Cmp::Le: return *order <= 0;
+            case Cmp::Gt: return *order > 0;
+            case Cmp::Ge: return *order >= 0;
+            }
+            return false;
+        }
+
+        // Decorate each row with its typed key once, sort the keys, then write the rows back.
+        static void sortRows(std::vector<const YamlNode*>& rows, const Stage& st, size_t threads) {
+            struct Key {
+                int rank; // 0 number, 1 string, 2 missing
+                double number;
+                std::string_view text;
+                const YamlNode* row;
+            };
+            std::vector<Key> keys(rows.size());
+            parallelFor((rows.size() + 4095) / 4096, threads, [&](size_t b) {
+                size_t end = std::min(rows.size(), (b + 1) * 4096);
+                for (size_t i = b * 4096; i < end; ++i) {
+                    const YamlNode* v = resolveColumnPath(*rows[i], st.path);
+                    Key& k = keys[i];
+                    k = Key{2, 0, {}, rows[i]};
+                    if (isNullScalar(v) || v->type != YamlNodeType::Scalar)
+                        continue;
+                    if (auto d = toDouble(*v); d && !std::isnan(*d))
+                        k.rank = 0, k.number = *d;
+                    else
+                        k.rank = 1, k.text = v->scalarValue;
+                }
+            });
+            parallelStableSort(keys, threads, [](const Key& a, const Key& b) {
+                if (a.rank != b.rank)
+                    return a.rank < b.rank;
+                return a.rank == 0 ? a.number < b.number : a.text < b.text;
+            });
+            for (size_t i = 0; i < rows.size(); ++i)
+                rows[i] = keys[i].row;
+        }
+
+        static std::vector<QueryGroup> aggregate(const std::vector<const YamlNode*>& rows, const Stage* groupBy,
+                                                 const Stage& agg) {
+            struct Acc {
+                size_t count = 0, numeric = 0;
+                double sum = 0, min = 0, max = 0;
+            };
+            std::unordered_map<std::string_view, size_t> index;
+            std::vector<std::pair<std::string_view, Acc>> accs;
+            size_t missing = SIZE_MAX; // The group of rows without a scalar group_by value, once one is seen
+            for (const YamlNode* r : rows) {
+                std::string_view key;
+                size_t slot = 0;
+                if (const YamlNode* k = groupBy ? resolveColumnPath(*r, groupBy->path) : nullptr;
+                    groupBy && (isNullScalar(k) || k->type != YamlNodeType::Scalar)) {
+                    if (missing == SIZE_MAX) {
+                        missing = accs.size();
+                        accs.emplace_back(key, Acc{});
+                    }
+                    slot = missing;
+                } else {
+                    if (k)
+                        key = k->scalarValue;
+                    auto [it, inserted] = index.try_emplace(key, accs.size());
+                    if (inserted)
+                        accs.emplace_back(key, Acc{});
+                    slot = it->second;
+                }
+                Acc& a = accs[slot].second;
+                ++a.count;
+                if (agg.kind == Kind::Count)
+                    continue;
+                const YamlNode* v = resolveColumnPath(*r, agg.path);
+                std::optional<double> d = v ? toDouble(*v) : std::nullopt;
+                if (!d)
+                    continue;
+                a.min = a.numeric ? std::min(a.min, *d) : *d;
+                a.max = a.numeric ? std::max(a.max, *d) : *d;
+                a.sum += *d;
+                ++a.numeric;
+            }
+            if (accs.empty() && !groupBy)
+                accs.emplace_back(std::string_view(), Acc{});
+
+            std::vector<QueryGroup> groups;
+            groups.reserve(accs.size());
+            const double nan = std::numeric_limits<double>::quiet_NaN();
+            for (size_t i = 0; i < accs.size(); ++i) {
+                const auto& [key, a] = accs[i];
+                QueryGroup& g = groups.emplace_back();
+                g.key = std::string(key);
+                g.missing = i == missing;
+                g.count = a.count;
+                switch (agg.kind) {
+                case Kind::Count: g.value = static_cast<double>(a.count); break;
+                case Kind::Sum: g.value = a.sum; break;
+                case Kind::Avg: g.value = a.numeric ? a.sum / static_cast<double>(a.numeric) : nan; break;
+                case Kind::Min: g.value = a.numeric ? a.min : nan; break;
+                default: g.value = a.numeric ? a.max : nan; break;
+                }
+            }
+            std::sort(groups.begin(), groups.end(), [](const QueryGroup& a, const QueryGroup& b) {
+                return a.missing != b.missing ? b.missing : a.key < b.key;
+            });
+            return groups;
+        }
+
+        std::vector<Stage> stages_;
+        std::vector<SelectPath> selectPaths_;
+    };
+
+    /**
+     * @brief Compile and run expr over seq in one call; see Query.
+     */
+    static QueryResult query(NodeView seq, std::string_view expr, size_t threads = 1) {
+        return Query::compile(expr).run(seq, threads);
+    }
+
+    // ---- Flattening to key-value pairs ----
+
+    /**
+     * @brief Path spelling for flatten and unflatten.
+     *
+     * The default gives at_path-compatible paths ("a.b[0].c"). With separator "_" and
+     * bracketIndices = false the same leaf is "a_b_0_c", as used for environment variables.
+     * Without brackets, a segment made only of digits is read back as a sequence index.
+     */
+    struct FlattenOptions {
+        std::string separator = ".";
+        bool bracketIndices = true;
+    };
+
+    /**
+     * @brief Call fn(std::string_view path, const YamlNode& leaf) for every scalar under node, in document order.
+     *
+     * All paths are built in one buffer, appending a segment on the way down and truncating it on
+     * the way up, so the cost per leaf is the length of its last segment rather than its depth.
+     * The path view is only valid during the call. Empty mappings and sequences have no leaves and
+     * are not reported.
+     */
+    template <class F> static void flatten(const YamlNode& node, F&& fn, const FlattenOptions& opts) {
+        std::string path;
+        flattenInto(node, path, fn, opts);
+    }
+    template <class F> static void flatten(const YamlNode& node, F&& fn) { flatten(node, fn, FlattenOptions{}); }
+
+    static std::vector<std::pair<std::string, std::string>> flattenToPairs(const YamlNode& node,
+                                                                           const FlattenOptions& opts) {
+        std::vector<std::pair<std::string, std::string>> pairs;
+        flatten(
+            node, [&](std::string_view path, const YamlNode& leaf) { pairs.emplace_back(path, leaf.scalarValue); },
+            opts);
+        return pairs;
+    }
+    static std::vector<std::pair<std::string, std::string>> flattenToPairs(const YamlNode& node) {
+        return flattenToPairs(node, FlattenOptions{});
+    }
+
+    /**
+     * @brief Builds a tree from flat (path, value) pairs; the inverse of flatten.
+     *
+     * The builder keeps the container chain of the previous path, so each pair only walks the
+     * segments that differ from its predecessor. Input in flatten's order (or sorted) is
+     * therefore a single pass. Any order gives the same tree, just with more lookups. A repeated
+     * path overwrites the earlier value.
+     *
+     * @throws YamlError when a path needs a container where another pair put a scalar, or vice versa.
+     */
+    class Unflattener {
+      public:
+        Unflattener() : Unflattener(FlattenOptions{}) {}
+        explicit Unflattener(FlattenOptions opts) : opts_(std::move(opts)) {}
+
+        void add(std::string_view path, std::string_view value) {
+            segments_.clear();
+            splitFlatPath(path, opts_, segments_);
+            // Keep the frames shared with the previous path, rebuilding the rest.
+            size_t keep = 0;
+            while (keep < segments_.size() && keep < chain_.size() && chain_[keep].matches(segments_[keep]))
+                ++keep;
+            chain_.resize(keep);
+            YamlNode* cur = keep ? chain_.back().node : &root_;
+            for (size_t i = keep; i < segments_.size(); ++i) {
+                const Segment& seg = segments_[i];
+                cur = &child(*cur, seg, path);
+                chain_.push_back(Frame{std::string(seg.key), seg.index, seg.isIndex, cur});
+            }
+            if (cur->type != YamlNodeType::Scalar)
+                throw YamlError("unflatten: '" + std::string(path) + "' is already a container");
+            cur->scalarValue.assign(value.data(), value.size());
+        }
+
+        YamlNode finish() {
+            chain_.clear();
+            return std::move(root_);
+        }
+
+      private:
+        // One segment of the path being added; key views into that path.
+        struct Segment {
+            std::string_view key;
+            size_t index = 0;
+            bool isIndex = false;
+        };
+        // A container on the previous path. It owns its key, since that path may be gone by the next add().
+        struct Frame {
+            std::string key;
+            size_t index;
+            bool isIndex;
+            YamlNode* node;
+
+            bool matches(const Segment& s) const {
+                return isIndex == s.isIndex && (isIndex ? index == s.index : key == s.key);
+            }
+        };
+
+        static YamlNode& child(YamlNode& parent, const Segment& seg, std::string_view path) {
+            YamlNodeType want = seg.isIndex ? YamlNodeType::Sequence : YamlNodeType::Mapping;
+            if (parent.type != want) {
+                // Only a node created on the way down (an empty scalar) may become a container.
+                if (parent.type != YamlNodeType::Scalar || !parent.scalarValue.empty())
+                    throw YamlError("unflatten: '" + std::string(path) + "' conflicts with an earlier path");
+                parent.type = want;
+            }
+            if (seg.isIndex) {
+                if (parent.sequence.size() <= seg.index)
+                    parent.sequence.resize(seg.index + 1);
+                return parent.sequence[seg.index];
+            }
+            // Sorted input appends, which the end() hint makes constant time.
+            return parent.mapping.try_emplace(parent.mapping.end(), std::string(seg.key))->second;
+        }
+
+        static void splitFlatPath(std::string_view path, const FlattenOptions& opts, std::vector<Segment>& out) {
+            const std::string_view sep = opts.separator;
+            auto isDigits = [](std::string_view s) {
+                return !s.empty() && std::all_of(s.begin(), s.end(), [](char c) { return c >= '0' && c <= '9'; });
+            };
+            size_t i = 0;
+            while (i < path.size()) {
+                if (!sep.empty() && path.compare(i, sep.size(), sep) == 0) {
+                    i += sep.size();
+                    continue;
+                }
+                Segment seg;
+                if (opts.bracketIndices && path[i] == '[') {
+                    size_t close = path.find(']', i);
+                    if (close == std::string_view::npos || !isDigits(path.substr(i + 1, close - i - 1)))
+                        throw YamlError("unflatten: malformed index in '" + std::string(path) + "'");
+                    std::from_chars(path.data() + i + 1, path.data() + close, seg.index);
+                    seg.isIndex = true;
+                    i = close + 1;
+                } else {
+                    size_t stop = sep.empty() ? std::string_view::npos : path.find(sep, i);
+                    if (opts.bracketIndices)
+                        stop = std::min(stop, path.find('[', i));
+                    stop = std::min(stop, path.size());
+                    std::string_view text = path.substr(i, stop - i);
+                    if (!opts.bracketIndices && isDigits(text)) {
+                        std::from_chars(text.data(), text.data() + text.size(), seg.index);
+                        seg.isIndex = true;
+                    } else {
+                        seg.key = text;
+                    }
+                    i = stop;
+                }
+                out.push_back(seg);
+            }
+        }
+
+        FlattenOptions opts_;
+        YamlNode root_;
+        std::vector<Frame> chain_;
+        std::vector<Segment> segments_;
+    };
+
+    static YamlNode unflatten(const std::vector<std::pair<std::string, std::string>>& pairs,
+                              const FlattenOptions& opts) {
+        Unflattener builder(opts);
+        for (const auto& [path, value] : pairs)
+            builder.add(path, value);
+        return builder.finish();
+    }
+    static YamlNode unflatten(const std::vector<std::pair<std::string, std::string>>& pairs) {
+        return unflatten(pairs, FlattenOptions{});
+    }
+
+  private:
+    template <class F>
+    static void flattenInto(const YamlNode& node, std::string& path, F& fn, const FlattenOptions& opts) {
+        std::vector<size_t> marks; // marks[d - 1]: path length before the segment of the node at depth d
+        auto pre = [&](const YamlNode& n, const TraversalContext& ctx) {
+            if (ctx.depth > 0) {
+                if (marks.size() < ctx.depth)
+                    marks.resize(ctx.depth);
+                marks[ctx.depth - 1] = path.size();
+                if (ctx.key) {
+                    if (!path.empty())
+                        path += opts.separator;
+                    path += *ctx.key;
+                } else {
+                    char digits[24];
+                    auto r = std::to_chars(digits, digits + sizeof(digits), ctx.index);
+                    if (opts.bracketIndices) {
+                        path.push_back('[');
+                        path.append(digits, r.ptr);
+                        path.push_back(']');
+                    } else {
+                        if (!path.empty())
+                            path += opts.separator;
+                        path.append(digits, r.ptr);
+                    }
+                }
+            }
+            if (n.type == YamlNodeType::Scalar)
+                fn(std::string_view(path), n);
+            return true;
+        };
+        auto post = [&](const YamlNode&, const TraversalContext& ctx) {
+            if (ctx.depth > 0)
+                path.resize(marks[ctx.depth - 1]);
+        };
+        traverse(node, pre, post);
+    }
+
+  private:
+    /**
+     * @brief Line-at-a-time event parser behind parseEvents.
+     */
+    template <class Handler> class EventParser {
+      public:
+        EventParser(std::istream& input, Handler& handler) : in_(input), h_(handler) {}
+
+        void run() {
+            std::string line;
+            while (nextLine(line)) {
+                if (isDocumentMarker(line)) {
+                    finishDocument();
+                    continue;
+                }
+                if (size_t hash = findComment(line); hash != std::string::npos)
+                    line.resize(hash);
+                if (line.find_first_not_of(" \t\r") == std::string::npos)
+                    continue;
+                int indent = getIndent(line, lineNum_);
+                handleLine(indent, trim(line.substr(static_cast<size_t>(indent))));
+            }
+            finishDocument();
+        }
+
+      private:
+        enum class Kind { Map, Seq, Pending }; // Pending: "key:" or "-" whose first child decides
+        struct Frame {
+            int indent; // Children are more indented than this
+            Kind kind;
+        };
+
+        bool nextLine(std::string& line) {
+            if (hasPushback_) {
+                hasPushback_ = false;
+                line.swap(pushback_);
+            } else if (!std::getline(in_, line)) {
+                return false;
+            }
+            ++lineNum_;
+            return true;
+        }
+        void pushBack(std::string& line) {
+            pushback_.swap(line);
+            hasPushback_ = true;
+            --lineNum_;
+        }
+
+        static bool isItem(const std::string& content) {
+            return content[0] == '-' && (content.size() == 1 || content[1] == ' ');
+        }
+
+        void closeTop() {
+            if (stack_.back().kind == Kind::Pending) { // No children: an empty mapping, as in the tree parser
+                h_.beginMap();
+                h_.end();
+            } else {
+                h_.end();
+            }
+            stack_.pop_back();
+        }
+
+        void finishDocument() {
+            if (!inDocument_)
+                return;
+            while (!stack_.empty())
+                closeTop();
+            h_.endDocument();
+            inDocument_ = false;
+            scalarIndent_ = -1;
+        }
+
+        void handleLine(int indent, const std::string& content) {
+            if (!inDocument_) {
+                inDocument_ = true;
+                h_.beginDocument();
+                stack_.push_back(Frame{-1, isItem(content) ? Kind::Seq : Kind::Map});
+                if (stack_.back().kind == Kind::Seq)
+                    h_.beginSeq();
+                else
+                    h_.beginMap();
+            }
+            if (scalarIndent_ >= 0) {
+                if (indent > scalarIndent_)
+                    throw YamlError("Unexpected indentation after scalar value", lineNum_);
+                scalarIndent_ = -1;
+            }
+            if (stack_.back().kind == Kind::Pending && indent > stack_.back().indent) {
+                stack_.back().kind = isItem(content) ? Kind::Seq : Kind::Map;
+                if (stack_.back().kind == Kind::Seq)
+                    h_.beginSeq();
+                else
+                    h_.beginMap();
+            }
+            while (stack_.size() > 1 && indent <= stack_.back().indent)
+                closeTop();
+
+            if (isItem(content)) {
+                if (stack_.back().kind != Kind::Seq)
+                    throw YamlError("Sequence item inside a mapping: " + content, lineNum_);
+                std::string item = trim(content.substr(1));
+                if (item.empty()) {
+                    stack_.push_back(Frame{indent, Kind::Pending});
+                } else if (isQuotedScalar(item)) {
+                    h_.scalar(unescape(item.substr(1, item.size() - 2)), ScalarStyle::Quoted);
+                } else if (size_t colon = item.find(": "); colon != std::string::npos || item.back() == ':') {
+                    // "- key: value": a mapping item whose keys sit where "key" starts
+                    int keyIndent = indent + static_cast<int>(content.size() - item.size());
+                    h_.beginMap();
+                    stack_.push_back(Frame{keyIndent - 1, Kind::Map});
+                    handleEntry(keyIndent, item);
+                } else {
+                    h_.scalar(item, ScalarStyle::Plain);
+                }
+                return;
+            }
+            if (stack_.back().kind != Kind::Map)
+                throw YamlError("Mapping entry inside a sequence: " + content, lineNum_);
+            handleEntry(indent, content);
+        }
+
+        void handleEntry(int indent, const std::string& content) {
+            size_t colonPos = content.find(':');
+            if (content[0] == '"' || content[0] == '\'') {
+                size_t close = findClosingQuote(content, 0);
+                if (close != std::string::npos)
+                    colonPos = content.find(':', close + 1);
+            }
+            if (colonPos == std::string::npos)
+                throw YamlError("Invalid mapping format (missing colon) on line " + std::to_string(lineNum_) + ": " +
+                                    content,
+                                lineNum_);
+            std::string key = trim(content.substr(0, colonPos));
+            if (key.empty())
+                throw YamlError("Invalid mapping format (empty key): " + content, lineNum_);
+            if (isQuotedScalar(key))
+                key = unescape(key.substr(1, key.size() - 2));
+            h_.key(key);
+
+            std::string value = trim(content.substr(colonPos + 1));
+            if (value.empty()) {
+                stack_.push_back(Frame{indent, Kind::Pending});
+            } else if (value[0] == '|' || value[0] == '>') {
+                char chomp = value.size() > 1 && (value[1] == '-' || value[1] == '+') ? value[1] : ' ';
+                std::string block = readBlock(indent);
+                if (value[0] == '>')
+                    block = foldBlock(block);
+                h_.scalar(applyChomp(block, chomp), value[0] == '|' ? ScalarStyle::Literal : ScalarStyle::Folded);
+            } else if ((value[0] == '"' || value[0] == '\'') && value.size() > 1 && value.back() == value[0]) {
+                h_.scalar(unescape(value.substr(1, value.size() - 2)), ScalarStyle::Quoted);
+                scalarIndent_ = indent;
+            } else if (value[0] == '[' && value.back() == ']') {
+                emitNode(parseFlowSequence(value.substr(1, value.size() - 2), lineNum_));
+            } else if (value[0] == '{' && value.back() == '}') {
+                emitNode(parseFlowMapping(value.substr(1, value.size() - 2), lineNum_));
+            } else {
+                if (value.find(": ") != std::string::npos)
+                    throw YamlError("Unquoted value contains ': ' - use quotes to avoid ambiguity", lineNum_);
+                h_.scalar(value, ScalarStyle::Plain);
+                scalarIndent_ = indent;
+            }
+        }
+
+        // Block scalar lines after a "key: |" header at baseIndent, as parseBlockScalar reads them.
+        std::string readBlock(int baseIndent) {
+            std::string content;
+            std::string line;
+            bool hasContent = false;
+            while (nextLine(line)) {
+                int nextIndent = getIndent(line, lineNum_);
+                if (trim(line).empty()) {
+                    if (hasContent)
+                        content += '\n';
+                    continue;
+                }
+                if (nextIndent <= baseIndent) {
+                    pushBack(line);
+                    break;
+                }
+                hasContent = true;
+                content.append(line, static_cast<size_t>(nextIndent), std::string::npos);
+                content += '\n';
+            }
+            return content;
+        }
+
+        // Events for a small node built from a one-line flow collection.
+        void emitNode(const YamlNode& node) {
+            switch (node.type) {
+            case YamlNodeType::Scalar:
+                h_.scalar(node.scalarValue, node.style);
+                break;
+            case YamlNodeType::Sequence:
+                h_.beginSeq();
+                for (const auto& item : node.sequence)
+                    emitNode(item);
+                h_.end();
+                break;
+            case YamlNodeType::Mapping:
+                h_.beginMap();
+                for (const auto& kv : node.mapping) {
+                    h_.key(kv.first);
+                    emitNode(kv.second);
+                }
+                h_.end();
+                break;
+            }
+        }
+
+        std::istream& in_;
+        Handler& h_;
+        std::vector<Frame> stack_;
+        std::string pushback_;
+        bool hasPushback_ = false;
+        bool inDocument_ = false;
+        int lineNum_ = 0;
+        int scalarIndent_ = -1; // Indent of the last "key: scalar" line; deeper lines are errors
+    };
+
+    /**
+     * @brief Write a length header: the fix form for small n (when fixBase != 0), else the 8/16/32-bit form.
+     *
+     * Pass 0 for op8 when the type has no 8-bit form (arrays, maps).
+     */
+    template <class Out>
+    static void writeMsgPackHeader(Out& out, size_t n, uint8_t fixBase, uint8_t op8, uint8_t op16, uint8_t op32) {
+        size_t fixMax = fixBase == 0xa0 ? 31 : 15;
+        if (fixBase && n <= fixMax) {
+            out.put(static_cast<char>(fixBase | n));
+        } else if (op8 && n <= 0xff) {
+            char b[2] = {static_cast<char>(op8), static_cast<char>(n)};
+            out.write(b, 2);
+        } else if (n <= 0xffff) {
+            char b[3] = {static_cast<char>(op16), static_cast<char>(n >> 8), static_cast<char>(n)};
+            out.write(b, 3);
+        } else {
+            if (n > 0xffffffffu)
+                throw YamlError("MessagePack: value too large");
+            char b[5] = {static_cast<char>(op32), static_cast<char>(n >> 24), static_cast<char>(n >> 16),
+                         static_cast<char>(n >> 8), static_cast<char>(n)};
+            out.write(b, 5);
+        }
+    }
+
+    template <class Out> static void writeMsgPackStr(Out& out, std::string_view s) {
+        writeMsgPackHeader(out, s.size(), 0xa0, 0xd9, 0xda, 0xdb);
+        out.write(s.data(), s.size());
+    }
+
+    template <class Out> static void writeMsgPackBE(Out& out, uint8_t op, uint64_t v, int bytes) {
+        char b[9];
+        b[0] = static_cast<char>(op);
+        for (int i = 0; i < bytes; ++i)
+            b[1 + i] = static_cast<char>(v >> (8 * (bytes - 1 - i)));
+        out.write(b, static_cast<size_t>(bytes) + 1);
+    }
+
+    /**
+     * @brief Write s as nil, a boolean, an integer or a float64 if that decodes back to the same text.
+     */
+    template <class Out> static bool writeMsgPackTyped(Out& out, std::string_view s) {
+        if (s.empty())
+            return false;
+        char c = s[0];
+        if ((c >= '0' && c <= '9') || c == '-') {
+            char buf[32];
+            const char* e = s.data() + s.size();
+            long long i = 0;
+            if (auto r = std::from_chars(s.data(), e, i); r.ec == std::errc{} && r.ptr == e) {
+                auto w = std::to_chars(buf, buf + sizeof(buf), i);
+                if (std::string_view(buf, static_cast<size_t>(w.ptr - buf)) != s)
+                    return false; // "007", "-0"
+                if (i >= -32 && i < 128) {
+                    out.put(static_cast<char>(i)); // Positive or negative fixint
+                } else {
+                    // Smallest of the 1/2/4/8-byte uint (0xcc..) or int (0xd0..) forms that holds i
+                    int width = 0;
+                    while (width < 3 && (i >= 0 ? static_cast<unsigned long long>(i) >> (8 << width) != 0
+                                                : i < -(1LL << ((8 << width) - 1))))
+                        ++width;
+                    writeMsgPackBE(out, static_cast<uint8_t>((i >= 0 ? 0xcc : 0xd0) + width), static_cast<uint64_t>(i),
+                                   1 << width);
+                }
+                return true;
+            }
+            double d = 0;
+            if (auto r = std::from_chars(s.data(), e, d); r.ec == std::errc{} && r.ptr == e && std::isfinite(d)) {
+                auto w = std::to_chars(buf, buf + sizeof(buf), d);
+                if (std::string_view(buf, static_cast<size_t>(w.ptr - buf)) != s)
+                    return false;
+                uint64_t bits;
+                std::memcpy(&bits, &d, sizeof(bits));
+                writeMsgPackBE(out, 0xcb, bits, 8);
+                return true;
+            }
+            return false;
+        }
+        if (s == "null") {
+            out.put(static_cast<char>(0xc0));
+            return true;
+        }
+        if (s == "true" || s == "false") {
+            out.put(static_cast<char>(s[0] == 't' ? 0xc3 : 0xc2));
+            return true;
+        }
+        return false;
+    }
+
+    /**
+     * @brief Recursive MessagePack reader behind decodeMsgPack.
+     */
+    template <class Handler> class MsgPackDecoder {
+      public:
+        static constexpr int kMaxDepth = 512;
+
+        MsgPackDecoder(std::string_view data, Handler& handler)
+            : p_(reinterpret_cast<const uint8_t*>(data.data())), begin_(p_), end_(p_ + data.size()), h_(handler) {}
+
+        size_t consumed() const { return static_cast<size_t>(p_ - begin_); }
+
+        void value(int depth) {
+            if (depth >= kMaxDepth)
+                throw YamlError("MessagePack: nesting too deep");
+            uint8_t op = byte();
+            if (op <= 0x7f || op >= 0xe0 || (op >= 0xca && op <= 0xd3) || op == 0xc0 || op == 0xc2 || op == 0xc3) {
+                h_.scalar(number(op), ScalarStyle::Plain);
+            } else if ((op & 0xe0) == 0xa0 || op == 0xd9 || op == 0xda || op == 0xdb || op == 0xc4 || op == 0xc5 ||
+                       op == 0xc6) {
+                // Plain text with a canonical typed reading is encoded typed, so such a string was Quoted.
+                std::string_view text = str(op);
+                CountingOutput discard;
+                h_.scalar(text, writeMsgPackTyped(discard, text) ? ScalarStyle::Quoted : ScalarStyle::Plain);
+            } else if ((op & 0xf0) == 0x90 || op == 0xdc || op == 0xdd) {
+                size_t n = (op & 0xf0) == 0x90 ? op & 0x0f : be(op == 0xdc ? 2 : 4);
+                h_.beginSeq();
+                for (size_t i = 0; i < n; ++i)
+                    value(depth + 1);
+                h_.end();
+            } else if ((op & 0xf0) == 0x80 || op == 0xde || op == 0xdf) {
+                size_t n = (op & 0xf0) == 0x80 ? op & 0x0f : be(op == 0xde ? 2 : 4);
+                h_.beginMap();
+                for (size_t i = 0; i < n; ++i) {
+                    uint8_t k = byte();
+                    h_.key(isStr(k) ? str(k) : number(k));
+                    value(depth + 1);
+                }
+                h_.end();
+            } else if (op >= 0xd4 && op <= 0xd8) {
+                ext(size_t{1} << (op - 0xd4));
+            } else if (op == 0xc7 || op == 0xc8 || op == 0xc9) {
+                ext(be(op == 0xc7 ? 1 : op == 0xc8 ? 2 : 4));
+            } else {
+                throw YamlError("MessagePack: unsupported type byte " + std::to_string(op));
+            }
+        }
+
+      private:
+        static bool isStr(uint8_t op) {
+            return (op & 0xe0) == 0xa0 || (op >= 0xd9 && op <= 0xdb) || (op >= 0xc4 && op <= 0xc6);
+        }
+
+        void need(size_t n) const {
+            if (static_cast<size_t>(end_ - p_) < n)
+                throw YamlError("MessagePack: truncated input");
+        }
+        uint8_t byte() {
+            need(1);
+            return *p_++;
+        }
+        uint64_t be(int bytes) {
+            need(static_cast<size_t>(bytes));
+            uint64_t v = 0;
+            for (int i = 0; i < bytes; ++i)
+                v = (v << 8) | *p_++;
+            return v;
+        }
+        std::string_view take(size_t n) {
+            need(n);
+            std::string_view s(reinterpret_cast<const char*>(p_), n);
+            p_ += n;
+            return s;
+        }
+
+        std::string_view str(uint8_t op) {
+            if ((op & 0xe0) == 0xa0)
+                return take(op & 0x1f);
+            int bytes = op == 0xd9 || op == 0xc4 ? 1 : op == 0xda || op == 0xc5 ? 2 : 4;
+            return take(be(bytes));
+        }
+
+        // Text of a nil, boolean, integer or float; valid until the next call.
+        std::string_view number(uint8_t op) {
+            char* b = buf_;
+            char* e = buf_ + sizeof(buf_);
+            std::to_chars_result r{b, std::errc{}};
+            if (op <= 0x7f)
+                r = std::to_chars(b, e, static_cast<int>(op));
+            else if (op >= 0xe0)
+                r = std::to_chars(b, e, static_cast<int>(static_cast<int8_t>(op)));
+            else if (op == 0xc0)
+                return "null";
+            else if (op == 0xc2)
+                return "false";
+            else if (op == 0xc3)
+                return "true";
+            else if (op == 0xca) {
+                uint32_t bits = static_cast<uint32_t>(be(4));
+                float f;
+                std::memcpy(&f, &bits, sizeof(f));
+                r = std::to_chars(b, e, f);
+            } else if (op == 0xcb) {
+                uint64_t bits = be(8);
+                double d;
+                std::memcpy(&d, &bits, sizeof(d));
+                r = std::to_chars(b, e, d);
+            } else if (op >= 0xcc && op <= 0xcf) {
+                r = std::to_chars(b, e, be(1 << (op - 0xcc)));
+            } else if (op >= 0xd0 && op <= 0xd3) {
+                int bytes = 1 << (op - 0xd0);
+                uint64_t v = be(bytes);
+                int shift = 64 - 8 * bytes; // Sign-extend
+                r = std::to_chars(b, e, static_cast<int64_t>(v << shift) >> shift);
+            } else {
+                throw YamlError("MessagePack: expected a scalar, got type byte " + std::to_string(op));
+            }
+            return std::string_view(b, static_cast<size_t>(r.ptr - b));
+        }
+
+        void ext(size_t n) {
+            int8_t type = static_cast<int8_t>(byte());
+            std::string_view payload = take(n);
+            if (type != kMsgPackBlockScalarExt || payload.empty() || (payload[0] != '|' && payload[0] != '>'))
+                throw YamlError("MessagePack: unsupported ext type " + std::to_string(type));
+            h_.scalar(payload.substr(1), payload[0] == '|' ? ScalarStyle::Literal : ScalarStyle::Folded);
+        }
+
+        const uint8_t* p_;
+        const uint8_t* begin_;
+        const uint8_t* end_;
+        Handler& h_;
+        char buf_[40];
+    };
+
+    // Split a column or query path once up front, so per-record lookups do no parsing.
+    static std::vector<PathSegment> parseColumnPath(std::string_view path) {
+        std::vector<PathSegment> steps;
+        if (!splitPath(path, steps))
+            throw YamlError("YAML: malformed column path '" + std::string(path) + "'");
+        return steps;
+    }
+
+    static const YamlNode* resolveColumnPath(const YamlNode& rec, const std::vector<PathSegment>& steps) {
+        const YamlNode* cur = &rec;
+        for (const auto& step : steps) {
+            if (step.isIndex) {
+                if (cur->type != YamlNodeType::Sequence || step.index >= cur->sequence.size())
+                    return nullptr;
+                cur = &cur->sequence[step.index];
+            } else {
+                if (cur->type != YamlNodeType::Mapping)
+                    return nullptr;
+                auto it = cur->mapping.find(step.key);
+                if (it == cur->mapping.end())
+                    return nullptr;
+                cur = &it->second;
+            }
+        }
+        return cur;
+    }
+
+    // Store v in row r of col; false when it is null or does not convert. String codes are block-local here.
+    static bool fillColumnCell(Column& col, size_t r, const YamlNode& v, std::vector<std::string_view>& dict,
+                               std::unordered_map<std::string_view, uint32_t>& index) {
+        switch (col.type) {
+        case ColumnType::Int:
+            if (auto i = toInt(v)) {
+                col.ints[r] = *i;
+                return true;
+            }
+            return false;
+        case ColumnType::Double:
+            if (auto d = toDouble(v)) {
+                col.doubles[r] = *d;
+                return true;
+            }
+            return false;
+        case ColumnType::Bool:
+            if (auto b = toBool(v)) {
+                col.bools[r] = *b;
+                return true;
+            }
+            return false;
+        case ColumnType::String:
+            if (v.type != YamlNodeType::Scalar)
+                return false;
+            auto [it, inserted] = index.try_emplace(v.scalarValue, static_cast<uint32_t>(dict.size()));
+            if (inserted)
+                dict.push_back(v.scalarValue);
+            col.codes[r] = it->second;
+            return true;
+        }
+        return false;
+    }
+
+  public:
+    /**
+     * @brief Convenience loader returning a Document view.
+     */
+    struct Document {
+        YamlNode root;
+        NodeView view() const { return NodeView{&root}; }
+    };
+    static Document loadFile(const std::string& filename, ParseStats* stats = nullptr) {
+        return Document{parseFile(filename, stats)};
+    }
+    static Document loadString(const std::string& text, ParseStats* stats = nullptr) {
+        return Document{parse(text, stats)};
+    }
+
+    /**
+     * @brief Reference-counted handle to an immutable node that keeps its whole document alive.
+     *
+     * Subtree handles share ownership of the frozen root (aliasing shared_ptr), so handing a
+     * subtree to another component is a refcount increment rather than a deep copy, and the
+     * handle stays valid after every other reference to the document is gone.
+     */
+    class SharedNode {
+      public:
+        SharedNode() = default;
+        explicit SharedNode(std::shared_ptr<const YamlNode> node) : node_(std::move(node)) {}
+
+        explicit operator bool() const { return node_ != nullptr; }
+        const YamlNode& operator*() const { return *node_; }
+        const YamlNode* operator->() const { return node_.get(); }
+
+        /**
+         * @brief Borrowed view; valid for as long as this handle (or any copy) is alive.
+         */
+        NodeView view() const { return NodeView{node_.get()}; }
+
+        SharedNode operator[](const std::string& key) const { return slice(view()[key]); }
+        SharedNode operator[](size_t idx) const { return slice(view()[idx]); }
+        SharedNode at_path(std::string_view path) const { return slice(view().at_path(path)); }
+
+        /**
+         * @brief Number of handles sharing the underlying document.
+         */
+        long use_count() const { return node_.use_count(); }
+
+      private:
+        SharedNode slice(NodeView v) const {
+            if (!v)
+                return {};
+            return SharedNode(std::shared_ptr<const YamlNode>(node_, v.n));
+        }
+
+        std::shared_ptr<const YamlNode> node_;
+    };
+
+    /**
+     * @brief Freeze a document into a shared immutable handle to its root. The tree is moved, not copied.
+     */
+    static SharedNode freeze(Document doc) {
+        YAML_TRACE_SCOPE(trace, "freeze", 0);
+        return SharedNode(std::make_shared<const YamlNode>(std::move(doc.root)));
+    }
+    static SharedNode loadSharedFile(const std::string& filename) { return freeze(loadFile(filename)); }
+    static SharedNode loadSharedString(const std::string& text) { return freeze(loadString(text)); }
+
+    // ============================================================================
+    // Streaming top-level records: iterate the elements of a huge root sequence
+    // (or the entries of a huge root mapping) one at a time.
+    // ============================================================================
+
+    /**
+     * @brief One top-level item produced by RecordReader.
+     */
+    struct Record {
+        size_t index = 0; // Position among the top-level items
+        int line = 0;     // 1-based line where the item starts
+        std::string key;  // Mapping key for top-level mapping entries; empty for sequence elements
+        Document doc;     // The element (or the entry's value) as a standalone document
+    };
+
+    /**
+     * @brief Pull parser yielding each top-level sequence element or mapping entry as its own Document.
+     *
+     * Only the lines of the current item are buffered, so memory stays constant no matter how
+     * many items the stream holds. Items start at column 0; "---" and "..." markers between
+     * items are skipped.
+     */
+    class RecordReader {
+      public:
+        explicit RecordReader(std::istream& input) : in_(input) {}
+
+        /**
+         * @brief Parse the next item into out.
+         * @return false at end of input.
+         * @throws YamlError on malformed input (line numbers refer to the whole stream).
+         */
+        bool next(Record& out) {
+            if (!hasPending_) {
+                while (!hasPending_ && std::getline(in_, pending_)) {
+                    ++line_;
+                    if (isItemStart(pending_))
+                        hasPending_ = true;
+                    else if (!isBlankOrMarker(pending_))
+                        throw YamlError("Expected a top-level item at column 0", line_);
+                }
+                if (!hasPending_)
+                    return false;
+                pendingLine_ = line_;
+            }
+            hasPending_ = false;
+            head_.swap(pending_);
+            out.line = pendingLine_;
+            out.index = index_++;
+
+            body_.clear();
+            while (std::getline(in_, pending_)) {
+                ++line_;
+                if (isItemStart(pending_)) {
+                    hasPending_ = true;
+                    pendingLine_ = line_;
+                    break;
+                }
+                if (isDocumentMarker(pending_))
+                    continue;
+                body_ += pending_;
+                body_ += '\n';
+            }
+            if (!hasPending_)
+                pending_.clear();
+
+            try {
+                buildRecord(out);
+            } catch (const YamlError& e) {
+                throw YamlError(e.what(), e.line >= 0 ? e.line + out.line - 1 : out.line, e.col);
+            }
+            return true;
+        }
+
+        /**
+         * @brief Input iterator over the remaining items; the referenced Record is reused.
+         */
+        class iterator {
+          public:
+            using iterator_category = std::input_iterator_tag;
+            using value_type = Record;
+            using difference_type = std::ptrdiff_t;
+            using pointer = Record*;
+            using reference = Record&;
+
+            iterator() = default;
+            explicit iterator(RecordReader* reader) : r_(reader) { ++*this; }
+
+            Record& operator*() const { return r_->current_; }
+            Record* operator->() const { return &r_->current_; }
+            iterator& operator++() {
+                if (!r_->next(r_->current_))
+                    r_ = nullptr;
+                return *this;
+            }
+            bool operator==(const iterator& other) const { return r_ == other.r_; }
+            bool operator!=(const iterator& other) const { return r_ != other.r_; }
+
+          private:
+            RecordReader* r_ = nullptr;
+        };
+        iterator begin() { return iterator(this); }
+        iterator end() { return iterator(); }
+
+      private:
+        static std::string_view stripComment(std::string_view line) { return line.substr(0, findComment(line)); }
+        static bool isBlankOrMarker(const std::string& line) {
+            std::string_view s = stripComment(line);
+            if (isDocumentMarker(s))
+                return true;
+            return s.find_first_not_of(" \t\r") == std::string_view::npos;
+        }
+        static bool isItemStart(const std::string& line) {
+            return !line.empty() && line[0] != ' ' && line[0] != '\t' && !isBlankOrMarker(line);
+        }
+
+        // Turns head_ (the column-0 line) plus body_ (its indented continuation) into a record.
+        void buildRecord(Record& out) {
+            std::string_view head = stripComment(head_);
+            out.key.clear();
+            if (head[0] != '-' || (head.size() > 1 && head[1] != ' ')) {
+                text_ = head_;
+                text_ += '\n';
+                text_ += body_;
+                YamlNode root = parse(text_);
+                if (!isMap(root) || root.mapping.size() != 1)
+                    throw YamlError("Expected exactly one top-level mapping entry");
+                auto it = root.mapping.begin();
+                out.key = it->first;
+                out.doc.root = std::move(it->second);
+                return;
+            }
+
+            // Sequence element: "- <content>" followed by lines indented past the dash.
+            size_t col = head.find_first_not_of(' ', 1);
+            std::string_view content = col == std::string_view::npos ? std::string_view{} : head.substr(col);
+            while (!content.empty() && (content.back() == ' ' || content.back() == '\r'))
+                content.remove_suffix(1);
+            if (content.empty()) {
+                if (trim(body_).empty()) {
+                    out.doc.root = YamlNode(YamlNodeType::Scalar);
+                    return;
+                }
+                out.doc.root = parse(body_);
+                return;
+            }
+            bool blockLike = content[0] == '-' || ((content[0] != '"' && content[0] != '\'' && content[0] != '[' &&
+                                                    content[0] != '{' && content[0] != '|' && content[0] != '>') &&
+                                                   (content.find(": ") != std::string_view::npos || content.back() == ':'));
+            if (blockLike) {
+                // Replace the dash with spaces so the content lines up with its continuation lines.
+                text_.assign(col, ' ');
+                text_ += content;
+                text_ += '\n';
+                text_ += body_;
+                out.doc.root = parse(text_);
+                return;
+            }
+            // Scalar, quoted, flow or block-scalar element: parse it as the value of a dummy key.
+            text_ = "v: ";
+            text_ += content;
+            text_ += '\n';
+            text_ += body_;
+            YamlNode root = parse(text_);
+            out.doc.root = std::move(root.mapping["v"]);
+        }
+
+        std::istream& in_;
+        std::string pending_; // Lookahead line that starts the next item
+        bool hasPending_ = false;
+        int pendingLine_ = 0;
+        int line_ = 0;
+        size_t index_ = 0;
+        std::string head_;
+        std::string body_;
+        std::string text_;
+        Record current_;
+    };
+
+    /**
+     * @brief Call fn(Record&) for every top-level item of input, in order.
+     */
+    template <class F> static void forEachRecord(std::istream& input, F&& fn) {
+        RecordReader reader(input);
+        Record rec;
+        while (reader.next(rec))
+            fn(rec);
+    }
+
+    /**
+     * @brief Parse only the subtrees at the given key paths, skipping everything else.
+     *
+     * Paths are dotted mapping keys; a "*" segment matches any key at that level
+     * ("spec.*.image"). Lines outside the requested paths are skipped by indentation alone,
+     * without building nodes or decoding scalars, and the stream is no longer read once every
+     * path without a wildcard has been found. Matched values are parsed as usual and placed at
+     * their original paths in the returned document, so view().at_path() works on the result.
+     * @param paths Up to 64 paths.
+     * @throws YamlError on too many paths or if a matched value fails to parse.
+     */
+    static Document project(std::istream& input, const std::vector<std::string>& paths) {
+        if (paths.size() > 64)
+            throw YamlError("Projection supports at most 64 paths");
+        std::vector<std::vector<std::string>> patterns;
+        uint64_t all = 0;
+        uint64_t wildcards = 0;
+        for (size_t i = 0; i < paths.size(); ++i) {
+            std::vector<std::string> segs;
+            std::istringstream iss(paths[i]);
+            std::string seg;
+            while (std::getline(iss, seg, '.')) {
+                if (!seg.empty())
+                    segs.push_back(seg);
+                if (seg == "*")
+                    wildcards |= uint64_t{1} << i;
+            }
+            if (!segs.empty())
+                all |= uint64_t{1} << i;
+            patterns.push_back(std::move(segs));
+        }
+
+        struct Level {
+            int indent;
+            std::string key;
+            uint64_t live; // Patterns whose prefix matches the path down to this key
+        };
+        std::vector<Level> stack;
+        Document out{YamlNode(YamlNodeType::Mapping)};
+        uint64_t found = 0;
+        std::string line;
+        std::string chunk;
+        bool pending = false; // `line` already holds the next unprocessed line
+        int skipIndent = -1;  // While >= 0, lines indented deeper than this are skipped
+        int lineNum = 0;
+
+        while (all != 0 && (pending || std::getline(input, line))) {
+            if (!pending)
+                ++lineNum;
+            pending = false;
+            size_t first = line.find_first_not_of(' ');
+            if (first == std::string::npos || line[first] == '#' || line[first] == '\r')
+                continue;
+            int indent = static_cast<int>(first);
+            if (skipIndent >= 0 && indent > skipIndent)
+                continue;
+            skipIndent = -1;
+            while (!stack.empty() && stack.back().indent >= indent)
+                stack.pop_back();
+
+            std::string_view content(line);
+            content.remove_prefix(first);
+            size_t colon = content.find(':');
+            if (content[0] == '-' || colon == std::string_view::npos) {
+                skipIndent = indent;
+                continue;
+            }
+            std::string_view key = content.substr(0, colon);
+            while (!key.empty() && key.back() == ' ')
+                key.remove_suffix(1);
+            if (key.size() >= 2 && (key[0] == '"' || key[0] == '\'') && key.back() == key[0])
+                key = key.substr(1, key.size() - 2);
+
+            size_t depth = stack.size();
+            uint64_t parentLive = stack.empty() ? all : stack.back().live;
+            uint64_t live = 0;
+            uint64_t complete = 0;
+            for (size_t i = 0; i < patterns.size(); ++i) {
+                uint64_t bit = uint64_t{1} << i;
+                if (!(parentLive & bit) || patterns[i].size() <= depth)
+                    continue;
+                const std::string& seg = patterns[i][depth];
+                if (seg != "*" && seg != key)
+                    continue;
+                (patterns[i].size() == depth + 1 ? complete : live) |= bit;
+            }
+
+            if (complete) {
+                // Materialize this entry: its line plus everything indented under it, dedented.
+                int startLine = lineNum;
+                std::string keyStr(key); // `key` and `content` point into `line`, which is about to be reused
+                chunk.assign(content.data(), content.size());
+                chunk += '\n';
+                while (std::getline(input, line)) {
+                    ++lineNum;
+                    size_t p = line.find_first_not_of(' ');
+                    if (p != std::string::npos && line[p] != '#' && line[p] != '\r' && static_cast<int>(p) <= indent) {
+                        pending = true;
+                        break;
+                    }
+                    if (static_cast<int>(line.size()) > indent)
+                        chunk.append(line, static_cast<size_t>(indent), std::string::npos);
+                    chunk += '\n';
+                }
+                YamlNode parsed;
+                try {
+                    parsed = parse(chunk);
+                } catch (const YamlError& e) {
+                    throw YamlError(e.what(), e.line >= 0 ? e.line + startLine - 1 : startLine, e.col);
+                }
+                YamlNode* dst = &out.root;
+                for (const Level& lv : stack) {
+                    dst = &dst->mapping[lv.key];
+                    dst->type = YamlNodeType::Mapping;
+                }
+                if (isMap(parsed) && !parsed.mapping.empty())
+                    dst->mapping[keyStr] = std::move(parsed.mapping.begin()->second);
+                // Longer patterns under this key were materialized along with it.
+                found |= complete | live;
+                if (wildcards == 0 && found == all)
+                    break;
+                continue;
+            }
+            if (live) {
+                std::string_view rest = content.substr(colon + 1);
+                if (rest.find_first_not_of(" \r") == std::string_view::npos)
+                    stack.push_back(Level{indent, std::string(key), live});
+                continue;
+            }
+            skipIndent = indent;
+        }
+        return out;
+    }
+    static Document projectString(const std::string& text, const std::vector<std::string>& paths) {
+        std::istringstream iss(text);
+        return project(iss, paths);
+    }
+
+    // ============================================================================
+    // Offset index: byte offsets of documents and top-level keys of a large file,
+    // persisted in a sidecar so queries read and parse only the slice they need.
+    // ============================================================================
+
+    /**
+     * @brief Byte ranges of the documents, top-level keys and (optionally) second-level keys of a file.
+     */
+    struct OffsetIndex {
+        enum Level : uint8_t { DocumentStart = 0, TopLevelKey = 1, SecondLevelKey = 2 };
+        struct Entry {
+            uint64_t offset = 0; // Byte offset of the entry's first line
+            uint64_t length = 0; // Bytes up to the next entry at the same or a shallower level
+            uint32_t doc = 0;    // Document number (0-based, separated by "---")
+            uint8_t level = DocumentStart;
+            std::string key; // "" for documents, "key" or "parent.child" otherwise
+        };
+
+        uint64_t fileSize = 0;
+        int64_t mtime = 0; // File modification time, in the filesystem clock's native ticks
+        std::vector<Entry> entries;
+
+        /**
+         * @brief Find a key ("services" or "services.payments") in document doc.
+         */
+        const Entry* find(std::string_view key, uint32_t doc = 0) const {
+            for (const Entry& e : entries)
+                if (e.doc == doc && e.level != DocumentStart && e.key == key)
+                    return &e;
+            return nullptr;
+        }
+        const Entry* document(uint32_t doc) const {
+            for (const Entry& e : entries)
+                if (e.doc == doc && e.level == DocumentStart)
+                    return &e;
+            return nullptr;
+        }
+    };
+
+    /**
+     * @brief Scan a file once and record the offsets of its documents and top-level keys.
+     * @param secondLevel Also index keys one level below each top-level key.
+     * @throws YamlError if the file cannot be opened.
+     */
+    static OffsetIndex buildIndex(const std::string& filename, bool secondLevel = false) {
+        std::ifstream in(filename, std::ios::binary);
+        if (!in.is_open())
+            throw YamlError("Cannot open file: " + filename);
+        OffsetIndex idx;
+        stampIndex(idx, filename);
+
+        auto add = [&](uint64_t offset, uint32_t doc, uint8_t level, std::string key) {
+            OffsetIndex::Entry e;
+            e.offset = offset;
+            e.doc = doc;
+            e.level = level;
+            e.key = std::move(key);
+            idx.entries.push_back(std::move(e));
+        };
+
+        std::string line;
+        uint64_t offset = 0;
+        uint32_t doc = 0;
+        bool docHasContent = false;
+        bool docClosed = false;       // A "..." line ended the current document
+        std::vector<uint64_t> docEnd; // Offset of the "---" or "..." line that ends each document
+        std::string topKey;
+        int childIndent = -1;    // Indent of the first child line under the current top-level key
+        bool topIsBlock = false; // Current top-level value is a block scalar: no keys inside
+        // The ':' ending a key that starts at `first`, looking past the closing quote of a quoted key.
+        auto keyColon = [&line](size_t first) {
+            size_t from = first;
+            if (line[first] == '"' || line[first] == '\'') {
+                size_t close = findClosingQuote(line, first);
+                if (close != std::string::npos)
+                    from = close + 1;
+            }
+            return line.find(':', from);
+        };
+        auto keyName = [&line](size_t first, size_t colon) {
+            std::string key = rtrim(line.substr(first, colon - first));
+            if (isQuotedScalar(key))
+                key = unescape(key.substr(1, key.size() - 2));
+            return key;
+        };
+        add(0, 0, OffsetIndex::DocumentStart, "");
+        while (std::getline(in, line)) {
+            uint64_t lineOffset = offset;
+            offset += line.size() + (in.eof() ? 0 : 1);
+            bool marker = isDocumentMarker(line);
+            if (marker && line[0] == '.') {
+                if (!docClosed)
+                    docEnd.push_back(lineOffset);
+                docClosed = true;
+                topKey.clear();
+                continue;
+            }
+            if (marker) {
+                if (docClosed) {
+                    add(offset, ++doc, OffsetIndex::DocumentStart, "");
+                    docClosed = false;
+                } else if (docHasContent) {
+                    docEnd.push_back(lineOffset);
+                    add(offset, ++doc, OffsetIndex::DocumentStart, "");
+                } else {
+                    idx.entries.back().offset = offset; // Only comments so far: the document starts here
+                }
+                docHasContent = false;
+                topKey.clear();
+                continue;
+            }
+            size_t first = line.find_first_not_of(' ');
+            if (first == std::string::npos || line[first] == '#' || line[first] == '\r')
+                continue;
+            if (docClosed) { // Content after "..." without a "---" starts the next document
+                add(lineOffset, ++doc, OffsetIndex::DocumentStart, "");
+                docClosed = false;
+            }
+            docHasContent = true;
+            size_t colon = keyColon(first);
+            if (first == 0) {
+                topKey.clear();
+                childIndent = -1;
+                if (line[0] == '-' || colon == std::string::npos)
+                    continue;
+                topKey = keyName(0, colon);
+                std::string rest = trim(line.substr(colon + 1));
+                topIsBlock = !rest.empty() && (rest[0] == '|' || rest[0] == '>');
+                add(lineOffset, doc, OffsetIndex::TopLevelKey, topKey);
+                continue;
+            }
+            if (!secondLevel || topKey.empty() || topIsBlock)
+                continue;
+            if (childIndent < 0)
+                childIndent = static_cast<int>(first);
+            if (static_cast<int>(first) != childIndent || line[first] == '-' || colon == std::string::npos)
+                continue;
+            add(lineOffset, doc, OffsetIndex::SecondLevelKey, topKey + "." + keyName(first, colon));
+        }
+
+        if (!docClosed)
+            docEnd.push_back(offset);
+
+        // Each entry extends to the next entry at the same or a shallower level, or to the end of its document.
+        for (size_t i = 0; i < idx.entries.size(); ++i) {
+            OffsetIndex::Entry& e = idx.entries[i];
+            uint64_t end = docEnd[e.doc];
+            for (size_t j = i + 1; j < idx.entries.size() && idx.entries[j].doc == e.doc; ++j) {
+                if (idx.entries[j].level <= e.level) {
+                    end = idx.entries[j].offset;
+                    break;
+                }
+            }
+            e.length = end > e.offset ? end - e.offset : 0;
+        }
+        return idx;
+    }
+
+    /**
+     * @brief Write an index to a sidecar file (native byte order; it is a local cache).
+     * @throws YamlError if the sidecar cannot be written.
+     */
+    static void saveIndex(const OffsetIndex& idx, const std::string& sidecar) {
+        std::ofstream out(sidecar, std::ios::binary | std::ios::trunc);
+        if (!out.is_open())
+            throw YamlError("Cannot write index: " + sidecar);
+        auto put = [&](const auto& v) { out.write(reinterpret_cast<const char*>(&v), sizeof(v)); };
+        out.write(kIndexMagic, 4);
+        put(kIndexVersion);
+        put(idx.fileSize);
+        put(idx.mtime);
+        put(static_cast<uint64_t>(idx.entries.size()));
+        for (const OffsetIndex::Entry& e : idx.entries) {
+            put(e.offset);
+            put(e.length);
+            put(e.doc);
+            put(e.level);
+            put(static_cast<uint32_t>(e.key.size()));
+            out.write(e.key.data(), static_cast<std::streamsize>(e.key.size()));
+        }
+        if (!out)
+            throw YamlError("Cannot write index: " + sidecar);
+    }
+
+    /**
+     * @brief Load a sidecar index for filename.
+     * @return nullopt if the sidecar is missing, malformed, or stale (file size or mtime changed).
+     */
+    static std::optional<OffsetIndex> loadIndex(const std::string& filename, const std::string& sidecar) {
+        std::ifstream in(sidecar, std::ios::binary);
+        if (!in.is_open())
+            return std::nullopt;
+        auto get = [&](auto& v) { return static_cast<bool>(in.read(reinterpret_cast<char*>(&v), sizeof(v))); };
+        char magic[4];
+        uint32_t version = 0;
+        uint64_t count = 0;
+        OffsetIndex idx;
+        if (!in.read(magic, 4) || std::memcmp(magic, kIndexMagic, 4) != 0 || !get(version) ||
+            version != kIndexVersion || !get(idx.fileSize) || !get(idx.mtime) || !get(count))
+            return std::nullopt;
+        OffsetIndex current;
+        try {
+            stampIndex(current, filename);
+        } catch (const YamlError&) {
+            return std::nullopt;
+        }
+        if (current.fileSize != idx.fileSize || current.mtime != idx.mtime)
+            return std::nullopt;
+        for (uint64_t i = 0; i < count; ++i) {
+            OffsetIndex::Entry e;
+            uint32_t keyLen = 0;
+            if (!get(e.offset) || !get(e.length) || !get(e.doc) || !get(e.level) || !get(keyLen))
+                return std::nullopt;
+            e.key.resize(keyLen);
+            if (!in.read(e.key.data(), keyLen))
+                return std::nullopt;
+            idx.entries.push_back(std::move(e));
+        }
+        return idx;
+    }
+
+    /**
+     * @brief Load filename's sidecar ("<filename>.yidx") if it is current, otherwise rebuild and save it.
+     */
+    static OffsetIndex openIndex(const std::string& filename, bool secondLevel = false) {
+        std::string sidecar = filename + ".yidx";
+        if (auto idx = loadIndex(filename, sidecar)) {
+            bool hasSecond = std::any_of(idx->entries.begin(), idx->entries.end(),
+                                         [](const auto& e) { return e.level == OffsetIndex::SecondLevelKey; });
+            if (hasSecond || !secondLevel)
+                return *idx;
+        }
+        OffsetIndex idx = buildIndex(filename, secondLevel);
+        saveIndex(idx, sidecar);
+        return idx;
+    }
+
+    /**
+     * @brief Read and parse only the bytes of one indexed key.
+     * @return The key's value.
+     * @throws YamlError if the key is not indexed or the slice fails to parse.
+     */
+    static YamlNode readIndexedKey(const std::string& filename, const OffsetIndex& idx, std::string_view key,
+                                   uint32_t doc = 0) {
+        const OffsetIndex::Entry* e = idx.find(key, doc);
+        if (!e)
+            throw YamlError("Key not in index: " + std::string(key));
+        YamlNode slice = parse(readSlice(filename, e->offset, e->length));
+        if (!isMap(slice) || slice.mapping.size() != 1)
+            throw YamlError("Indexed slice is not a single mapping entry: " + std::string(key));
+        return std::move(slice.mapping.begin()->second);
+    }
+
+    /**
+     * @brief Read and parse only the bytes of document number doc.
+     */
+    static YamlNode readIndexedDocument(const std::string& filename, const OffsetIndex& idx, uint32_t doc) {
+        const OffsetIndex::Entry* e = idx.document(doc);
+        if (!e)
+            throw YamlError("Document not in index: " + std::to_string(doc));
+        return parse(readSlice(filename, e->offset, e->length));
+    }
+
+    /**
+     * @brief Bounded lock-free multi-producer/multi-consumer queue (Vyukov ring buffer).
+     *
+     * Each slot carries a sequence number telling producers and consumers whose turn it is,
+     * so push and pop are a single CAS on the tail or head index in the uncontended case.
+     */
+    template <class T> class BoundedQueue {
+      public:
+        explicit BoundedQueue(size_t capacity) {
+            size_t n = 2;
+            while (n < capacity)
+                n <<= 1;
+            mask_ = n - 1;
+            cells_.reset(new Cell[n]);
+            for (size_t i = 0; i < n; ++i)
+                cells_[i].seq.store(i, std::memory_order_relaxed);
+        }
+        BoundedQueue(const BoundedQueue&) = delete;
+        BoundedQueue& operator=(const BoundedQueue&) = delete;
+
+        size_t capacity() const { return mask_ + 1; }
+
+        // Snapshots that may be stale by the time they return; used to decide whether to keep waiting.
+        bool seemsEmpty() const {
+            return tail_.load(std::memory_order_acquire) == head_.load(std::memory_order_acquire);
+        }
+        bool seemsFull() const {
+            return tail_.load(std::memory_order_acquire) - head_.load(std::memory_order_acquire) > mask_;
+        }
+
+        /**
+         * @brief Enqueue unless full. v is only moved from on success.
+         */
+        bool tryPush(T& v) {
+            size_t pos = tail_.load(std::memory_order_relaxed);
+            for (;;) {
+                Cell& cell = cells_[pos & mask_];
+                size_t seq = cell.seq.load(std::memory_order_acquire);
+                auto diff = static_cast<std::ptrdiff_t>(seq) - static_cast<std::ptrdiff_t>(pos);
+                if (diff == 0) {
+                    if (tail_.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+                        cell.value = std::move(v);
+                        cell.seq.store(pos + 1, std::memory_order_release);
+                        return true;
+                    }
+                } else if (diff < 0) {
+                    return false;
+                } else {
+                    pos = tail_.load(std::memory_order_relaxed);
+                }
+            }
+        }
+
+        /**
+         * @brief Dequeue into out unless empty.
+         */
+        bool tryPop(T& out) {
+            size_t pos = head_.load(std::memory_order_relaxed);
+            for (;;) {
+                Cell& cell = cells_[pos & mask_];
+                size_t seq = cell.seq.load(std::memory_order_acquire);
+                auto diff = static_cast<std::ptrdiff_t>(seq) - static_cast<std::ptrdiff_t>(pos + 1);
+                if (diff == 0) {
+                    if (head_.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+                        out = std::move(cell.value);
+                        cell.seq.store(pos + mask_ + 1, std::memory_order_release);
+                        return true;
+                    }
+                } else if (diff < 0) {
+                    return false;
+                } else {
+                    pos = head_.load(std::memory_order_relaxed);
+                }
+            }
+        }
+
+      private:
+        struct alignas(64) Cell {
+            std::atomic<size_t> seq{0};
+            T value = T();
+        };
+
+        size_t mask_ = 0;
+        std::unique_ptr<Cell[]> cells_;
+        alignas(64) std::atomic<size_t> head_{0};
+        alignas(64) std::atomic<size_t> tail_{0};
+    };
+
+    /**
+     * @brief Where threads wait for a BoundedQueue to change: spin briefly, yield a while, then sleep.
+     *
+     * Sleepers announce themselves before re-checking their condition under the mutex, and
+     * notify() only takes the mutex when someone has announced, so the uncontended path costs a
+     * fence and a load while idle threads use no CPU.
+     */
+    class QueueSignal {
+      public:
+        /**
+         * @brief One wait step; returns at once while spinning, blocks until ready() once spins run out.
+         */
+        template <class Ready> void wait(unsigned& spins, Ready&& ready) {
+            if (++spins < 64)
+                return;
+            if (spins < 128) {
+                std::this_thread::yield();
+                return;
+            }
+            std::unique_lock<std::mutex> lock(mutex_);
+            sleepers_.fetch_add(1, std::memory_order_seq_cst);
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+            parks_.fetch_add(1, std::memory_order_relaxed);
+            cv_.wait(lock, ready);
+            sleepers_.fetch_sub(1, std::memory_order_relaxed);
+        }
+
+        // Threads blocked in wait() right now, and the number of times any thread has blocked.
+        size_t sleeping() const { return sleepers_.load(std::memory_order_relaxed); }
+        size_t parks() const { return parks_.load(std::memory_order_relaxed); }
+
+        /**
+         * @brief Wake the sleepers, if any; call after every change a waiter may be waiting for.
+         */
+        void notify() {
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+            if (sleepers_.load(std::memory_order_relaxed) == 0)
+                return;
+            std::lock_guard<std::mutex> lock(mutex_); // A waiter between its check and its sleep holds this
+            cv_.notify_all();
+        }
+
+      private:
+        std::mutex mutex_;
+        std::condition_variable cv_;
+        std::atomic<size_t> sleepers_{0};
+        std::atomic<size_t> parks_{0};
+    };
+
+    /**
+     * @brief Parse top-level records on the calling thread while `consumers` threads run fn(Record&).
+     *
+     * Records flow through a BoundedQueue of queueCapacity slots; when consumers fall behind the
+     * queue fills up and parsing pauses until a slot frees. Threads with nothing to do sleep
+     * after a short spin, so a slow stream or a stalled fn does not burn CPU. Records are
+     * processed in no particular order (Record::index gives the original position). The first
+     * exception thrown by the parser or by fn stops the pipeline and is rethrown after all
+     * threads have joined.
+     */
+    template <class F>
+    static void processRecordsParallel(std::istream& input, size_t consumers, F&& fn, size_t queueCapacity = 256) {
+        if (consumers == 0)
+            consumers = std::max(1u, std::thread::hardware_concurrency());
+        BoundedQueue<Record> queue(queueCapacity);
+        QueueSignal notEmpty, notFull;
+        std::atomic<bool> done{false};
+        std::atomic<bool> stop{false};
+        std::mutex errorMutex;
+        std::exception_ptr error;
+        auto fail = [&](std::exception_ptr e) {
+            {
+                std::lock_guard<std::mutex> lock(errorMutex);
+                if (!error)
+                    error = e;
+                stop.store(true, std::memory_order_release);
+            }
+            notEmpty.notify();
+            notFull.notify();
+        };
+        auto consumable = [&] {
+            return !queue.seemsEmpty() || done.load(std::memory_order_acquire) ||
+                   stop.load(std::memory_order_acquire);
+        };
+        auto pushable = [&] { return !queue.seemsFull() || stop.load(std::memory_order_acquire); };
+
+        std::vector<std::thread> workers;
+        workers.reserve(consumers);
+        for (size_t i = 0; i < consumers; ++i) {
+            workers.emplace_back([&] {
+                Record rec;
+                unsigned spins = 0;
+                while (!stop.load(std::memory_order_acquire)) {
+                    // Check `done` before popping: once it is set every push has completed,
+                    // so a failed pop really means the queue is drained.
+                    bool finished = done.load(std::memory_order_acquire);
+                    if (queue.tryPop(rec)) {
+                        spins = 0;
+                        notFull.notify();
+                        try {
+                            fn(rec);
+                        } catch (...) {
+                            fail(std::current_exception());
+                        }
+                    } else if (finished) {
+                        break;
+                    } else {
+                        notEmpty.wait(spins, consumable);
+                    }
+                }
+            });
+        }
+
+        try {
+            RecordReader reader(input);
+            Record rec;
+            while (!stop.load(std::memory_order_acquire) && reader.next(rec)) {
+                unsigned spins = 0;
+                while (!queue.tryPush(rec) && !stop.load(std::memory_order_acquire))
+                    notFull.wait(spins, pushable);
+                notEmpty.notify();
+            }
+        } catch (...) {
+            fail(std::current_exception());
+        }
+        done.store(true, std::memory_order_release);
+        notEmpty.notify();
+        for (auto& t : workers)
+            t.join();
+        if (error)
+            std::rethrow_exception(error);
+    }
+
+    // ============================================================================
+    // Concurrent mutable document: writers to disjoint top-level subtrees do not
+    // contend, and version counters let readers detect changes without locking.
+    // ============================================================================
+
+    class ConcurrentDocument;
+
+    /**
+     * @brief Type-independent part of ConfigCell: the binding of a cell to a document path.
+     *
+     * The document refreshes every bound cell of a stripe while it still holds that stripe's
+     * write lock, so a cell never has two concurrent writers.
      */
-    struct NodeView {
-        const YamlNode* n{nullptr};
+    class ConfigCellBase {
+      public:
+        ConfigCellBase(const ConfigCellBase&) = delete;
+        ConfigCellBase& operator=(const ConfigCellBase&) = delete;
 
-        explicit operator bool() const { return n != nullptr; }
-        bool is_scalar() const { return n && n->type == YamlNodeType::Scalar; }
-        bool is_map() const { return n && n->type == YamlNodeType::Mapping; }
-        bool is_seq() const { return n && n->type == YamlNodeType::Sequence; }
+        const std::string& path() const { return path_; }
 
-        const std::string& as_str() const { return YamlParser::asString(*n); }
-        const std::map<std::string, YamlNode>& as_map() const { return YamlParser::asMap(*n); }
-        const std::vector<YamlNode>& as_seq() const { return YamlParser::asSeq(*n); }
+      protected:
+        explicit ConfigCellBase(std::string path) : path_(std::move(path)) {}
+        virtual ~ConfigCellBase() = default;
 
-        std::optional<bool> to_bool() const { return YamlParser::toBool(*n); }
-        std::optional<long long> to_int() const { return YamlParser::toInt(*n); }
-        std::optional<double> to_double() const { return YamlParser::toDouble(*n); }
+        /**
+         * @brief Re-decode the value from the node at path (empty view if missing).
+         */
+        virtual void refresh(NodeView v) = 0;
 
-        NodeView operator[](const std::string& key) const {
-            if (!is_map())
-                return {};
-            auto it = n->mapping.find(key);
-            if (it == n->mapping.end())
-                return {};
-            return NodeView{&it->second};
+        void attach(ConcurrentDocument& doc) { doc.bindCell(this); }
+        void detach() {
+            if (doc_)
+                doc_->unbindCell(this);
         }
-        NodeView operator[](size_t idx) const {
-            if (!is_seq())
-                return {};
-            if (idx >= n->sequence.size())
-                return {};
-            return NodeView{&n->sequence[idx]};
+
+      private:
+        friend class ConcurrentDocument;
+        std::string path_;
+        ConcurrentDocument* doc_ = nullptr;
+        size_t stripe_ = 0;
+    };
+
+    /**
+     * @brief Mutable document shared by concurrent readers and writers.
+     *
+     * Every top-level key (or top-level index) hashes to one of kStripes lock stripes; a write
+     * locks only its stripe exclusively, so writers to different top-level subtrees proceed in
+     * parallel. A separate root lock, held shared by everyone, is taken exclusively only when
+     * the top-level collection itself changes shape (adding or erasing a top-level entry,
+     * replacing the whole document).
+     *
+     * Each stripe also carries a seqlock-style version counter: it is odd while a write is in
+     * progress and advances by two per completed write. Callers that cache values derived from
+     * a path can compare version(path) against the version they saw instead of re-reading.
+     * Node contents are still read under a shared stripe lock, since std::string and std::map
+     * cannot be copied safely while a writer mutates them.
+     */
+    class ConcurrentDocument {
+      public:
+        static constexpr size_t kStripes = 64;
+
+        explicit ConcurrentDocument(YamlNode root = YamlNode(YamlNodeType::Mapping)) : root_(std::move(root)) {}
+        ConcurrentDocument(const ConcurrentDocument&) = delete;
+        ConcurrentDocument& operator=(const ConcurrentDocument&) = delete;
+        ~ConcurrentDocument() {
+            for (Stripe& stripe : stripes_)
+                for (ConfigCellBase* cell : stripe.cells)
+                    cell->doc_ = nullptr;
         }
 
-        // Very simple path: "a.b[2].c"
-        NodeView at_path(std::string_view path) const {
-            const char* p = path.data();
-            const char* end = p + path.size();
-            NodeView cur{n};
-            std::string token;
-            while (p < end) {
-                if (*p == '.') {
-                    ++p;
-                    continue;
-                }
-                token.clear();
-                while (p < end && *p != '.' && *p != '[') {
-                    token.push_back(*p++);
-                }
-                if (!token.empty()) {
-                    cur = cur[token];
-                    if (!cur)
-                        return {};
-                }
-                if (p < end && *p == '[') {
-                    ++p;
-                    size_t idx = 0;
-                    while (p < end && std::isdigit(static_cast<unsigned char>(*p))) {
-                        idx = idx * 10 + (*p - '0');
-                        ++p;
-                    }
-                    if (p == end || *p != ']')
-                        return {};
-                    ++p;
-                    cur = cur[idx];
-                    if (!cur)
-                        return {};
-                }
+        /**
+         * @brief Call fn(NodeView) for the node at path while it is protected from writers.
+         * The view (empty if the path does not exist) must not escape fn.
+         */
+        template <class F> decltype(auto) read(std::string_view path, F&& fn) const {
+            std::vector<PathSegment>& segs = scratch();
+            if (!splitPath(path, segs))
+                return fn(NodeView{});
+            if (segs.empty()) {
+                // Whole-document reads are rare; excluding everyone is cheaper than taking every stripe.
+                std::unique_lock<std::shared_mutex> rootLock(rootMutex_);
+                return fn(NodeView{&root_});
             }
-            return cur;
+            std::shared_lock<std::shared_mutex> rootLock(rootMutex_);
+            std::shared_lock<std::shared_mutex> lock(stripeFor(segs.front()).mutex);
+            return fn(NodeView{&root_}.at_path(path));
+        }
+
+        /**
+         * @brief Copy of the scalar at path, or nullopt if missing or not a scalar.
+         */
+        std::optional<std::string> get(std::string_view path) const {
+            return read(path, [](NodeView v) -> std::optional<std::string> {
+                if (!v.is_scalar())
+                    return std::nullopt;
+                return v.as_str();
+            });
         }
 
+        /**
+         * @brief Typed read with default, same conversions as NodeView::value.
+         */
         template <class T> T value(std::string_view path, T def) const {
-            NodeView v = at_path(path);
-            if (!v)
-                return def;
-            if constexpr (std::is_same_v<T, std::string>) {
-                return v.is_scalar() ? v.as_str() : def;
-            } else if constexpr (std::is_same_v<T, const char*>) {
-                return v.is_scalar() ? v.as_str().c_str() : def;
-            } else if constexpr (std::is_same_v<T, bool>) {
-                auto b = v.to_bool();
-                return b ? *b : def;
-            } else if constexpr (std::is_integral_v<T> && !std::is_same_v<T, bool>) {
-                auto i = v.to_int();
-                return i ? static_cast<T>(*i) : def;
-            } else if constexpr (std::is_floating_point_v<T>) {
-                auto d = v.to_double();
-                return d ? static_cast<T>(*d) : def;
-            } else {
-                return def;
-            }
+            static_assert(!std::is_same_v<T, const char*>, "pointer would outlive the lock; use std::string");
+            return read(path, [&](NodeView v) { return v ? v.value<T>("", def) : def; });
         }
-    };
 
-    // ---- Emission to YAML ----
-    static void emitYaml(const YamlNode& node, std::ostream& os, int indent = 0) {
-        std::string ind(indent * 2, ' ');
-        switch (node.type) {
-        case YamlNodeType::Scalar: {
-            if (node.style == ScalarStyle::Literal && node.scalarValue.find('\n') != std::string::npos) {
-                os << ind << "|" << std::endl;
-                std::istringstream iss(node.scalarValue);
-                std::string subline;
-                int subindent = indent + 1;
-                std::string subInd(subindent * 2, ' ');
-                while (std::getline(iss, subline)) {
-                    os << subInd << subline << std::endl;
-                }
-            } else if (node.style == ScalarStyle::Folded && node.scalarValue.find('\n') != std::string::npos) {
-                os << ind << ">" << std::endl;
-                std::istringstream iss(node.scalarValue);
-                std::string subline;
-                int subindent = indent + 1;
-                std::string subInd(subindent * 2, ' ');
-                while (std::getline(iss, subline)) {
-                    os << subInd << subline << std::endl;
+        /**
+         * @brief Call fn(YamlNode&) on the node at path, creating missing mapping keys on the way.
+         *
+         * Null scalars on the path are turned into mappings (or sequences for an index step),
+         * and an index equal to the sequence size appends a new element.
+         * @throws YamlError if the path is malformed, steps through a non-empty scalar, or
+         *         indexes past the end of a sequence.
+         */
+        template <class F> void update(std::string_view path, F&& fn) {
+            std::vector<PathSegment>& segs = scratch();
+            if (!splitPath(path, segs))
+                throw YamlError("Malformed path: " + std::string(path));
+            if (!segs.empty()) {
+                std::shared_lock<std::shared_mutex> rootLock(rootMutex_);
+                if (hasTopLevel(segs.front())) {
+                    Stripe& stripe = stripeFor(segs.front());
+                    std::unique_lock<std::shared_mutex> lock(stripe.mutex);
+                    VersionBump bump(stripe.version);
+                    updateNode(resolve(root_, segs), fn);
+                    refreshCells(stripe);
+                    return;
                 }
-            } else {
-                os << ind << node.scalarValue;
             }
-        } break;
-        case YamlNodeType::Sequence: {
-            bool allScalar = std::all_of(node.sequence.begin(), node.sequence.end(), [](const YamlNode& it) {
-                return it.type == YamlNodeType::Scalar && it.style == ScalarStyle::Plain;
+            // The top-level collection changes shape: exclude every reader and writer.
+            std::unique_lock<std::shared_mutex> rootLock(rootMutex_);
+            if (segs.empty()) {
+                BumpAll bump(stripes_);
+                updateNode(root_, fn);
+                refreshAllCells();
+                return;
+            }
+            Stripe& stripe = stripeFor(segs.front());
+            VersionBump bump(stripe.version);
+            updateNode(resolve(root_, segs), fn);
+            refreshCells(stripe);
+        }
+
+        /**
+         * @brief Replace the node at path with a plain scalar.
+         */
+        void set(std::string_view path, std::string value) {
+            update(path, [&](YamlNode& n) {
+                // In place rather than assigning a fresh node, which would also drop the read counts
+                n.type = YamlNodeType::Scalar;
+                n.style = ScalarStyle::Plain;
+                n.sequence.clear();
+                n.mapping.clear();
+                n.scalarValue = std::move(value);
             });
-            if (allScalar && node.sequence.size() <= 5) {
-                os << ind << "[";
-                for (size_t i = 0; i < node.sequence.size(); ++i) {
-                    if (i > 0)
-                        os << ", ";
-                    os << node.sequence[i].scalarValue;
-                }
-                os << "]" << "\n";
-            } else {
-                for (const auto& item : node.sequence) {
-                    os << ind << "- ";
-                    if (item.type == YamlNodeType::Scalar && item.style == ScalarStyle::Plain) {
-                        os << item.scalarValue << "\n";
-                    } else {
-                        os << "\n";
-                        emitYaml(item, os, indent + 1);
-                    }
+        }
+
+        /**
+         * @brief Remove the node at path from its parent.
+         * @return true if something was removed.
+         */
+        bool erase(std::string_view path) {
+            std::vector<PathSegment>& segs = scratch();
+            if (!splitPath(path, segs) || segs.empty())
+                return false;
+            PathSegment last = std::move(segs.back());
+            segs.pop_back();
+            auto eraseFrom = [&](YamlNode& parent) {
+                if (last.isIndex) {
+                    if (!isSeq(parent) || last.index >= parent.sequence.size())
+                        return false;
+                    parent.sequence.erase(parent.sequence.begin() + static_cast<std::ptrdiff_t>(last.index));
+                    return true;
+                }
+                return isMap(parent) && parent.mapping.erase(last.key) > 0;
+            };
+            if (segs.empty()) {
+                std::unique_lock<std::shared_mutex> rootLock(rootMutex_);
+                Stripe& stripe = stripeFor(last);
+                VersionBump bump(stripe.version);
+                bool erased = eraseFrom(root_);
+                refreshCells(stripe);
+                return erased;
+            }
+            std::shared_lock<std::shared_mutex> rootLock(rootMutex_);
+            Stripe& stripe = stripeFor(segs.front());
+            std::unique_lock<std::shared_mutex> lock(stripe.mutex);
+            YamlNode* parent = find(segs);
+            if (!parent)
+                return false;
+            VersionBump bump(stripe.version);
+            bool erased = eraseFrom(*parent);
+            refreshCells(stripe);
+            return erased;
+        }
+
+        /**
+         * @brief Version of the stripe owning path (even when no write is in flight).
+         * The empty path returns the sum over all stripes, which changes on any write.
+         */
+        uint64_t version(std::string_view path) const {
+            std::vector<PathSegment>& segs = scratch();
+            if (splitPath(path, segs) && !segs.empty())
+                return stripeFor(segs.front()).version.load(std::memory_order_acquire);
+            uint64_t sum = 0;
+            for (const Stripe& s : stripes_)
+                sum += s.version.load(std::memory_order_acquire);
+            return sum;
+        }
+
+        /**
+         * @brief Consistent deep copy of the whole document.
+         */
+        YamlNode snapshot() const {
+            std::unique_lock<std::shared_mutex> rootLock(rootMutex_);
+            return root_;
+        }
+
+        /**
+         * @brief Atomically replace the whole document.
+         */
+        void reload(YamlNode root) {
+            std::unique_lock<std::shared_mutex> rootLock(rootMutex_);
+            BumpAll bump(stripes_);
+            root_ = std::move(root);
+            refreshAllCells();
+        }
+
+        /**
+         * @brief Re-parse a file and atomically swap it in. Parsing happens outside any lock.
+         * @throws YamlError if the file cannot be read or parsed; the document is left unchanged.
+         */
+        void reloadFile(const std::string& filename) { reload(parseFile(filename)); }
+
+      private:
+        friend class ConfigCellBase;
+
+        struct alignas(64) Stripe {
+            std::shared_mutex mutex;
+            std::atomic<uint64_t> version{0};
+            std::vector<ConfigCellBase*> cells;
+        };
+
+        // Makes the stripe version odd for the duration of a write.
+        struct VersionBump {
+            std::atomic<uint64_t>& v;
+            explicit VersionBump(std::atomic<uint64_t>& ver) : v(ver) { v.fetch_add(1, std::memory_order_acq_rel); }
+            ~VersionBump() { v.fetch_add(1, std::memory_order_release); }
+        };
+        struct BumpAll {
+            std::array<Stripe, kStripes>& s;
+            explicit BumpAll(std::array<Stripe, kStripes>& st) : s(st) {
+                for (Stripe& x : s)
+                    x.version.fetch_add(1, std::memory_order_acq_rel);
+            }
+            ~BumpAll() {
+                for (Stripe& x : s)
+                    x.version.fetch_add(1, std::memory_order_release);
+            }
+        };
+
+        // Per-thread segment buffer so path splitting does not allocate on every call. Segments are
+        // consumed before any user callback runs, so re-entrant calls from inside fn are safe.
+        static std::vector<PathSegment>& scratch() {
+            thread_local std::vector<PathSegment> segs;
+            return segs;
+        }
+
+        static size_t stripeIndex(const PathSegment& seg) {
+            size_t h = seg.isIndex ? seg.index : std::hash<std::string_view>{}(seg.key);
+            return h % kStripes;
+        }
+        Stripe& stripeFor(const PathSegment& seg) const { return stripes_[stripeIndex(seg)]; }
+
+        // Callers hold the stripe (or the root) exclusively.
+        void refreshCells(Stripe& stripe) {
+            for (ConfigCellBase* cell : stripe.cells)
+                cell->refresh(NodeView{&root_}.at_path(cell->path_));
+        }
+        void refreshAllCells() {
+            for (Stripe& stripe : stripes_)
+                refreshCells(stripe);
+        }
+
+        void bindCell(ConfigCellBase* cell) {
+            std::vector<PathSegment>& segs = scratch();
+            if (!splitPath(cell->path_, segs) || segs.empty())
+                throw YamlError("ConfigCell needs a non-empty path: " + cell->path_);
+            size_t idx = stripeIndex(segs.front());
+            std::shared_lock<std::shared_mutex> rootLock(rootMutex_);
+            std::unique_lock<std::shared_mutex> lock(stripes_[idx].mutex);
+            stripes_[idx].cells.push_back(cell);
+            cell->doc_ = this;
+            cell->stripe_ = idx;
+            cell->refresh(NodeView{&root_}.at_path(cell->path_));
+        }
+        void unbindCell(ConfigCellBase* cell) {
+            std::shared_lock<std::shared_mutex> rootLock(rootMutex_);
+            Stripe& stripe = stripes_[cell->stripe_];
+            std::unique_lock<std::shared_mutex> lock(stripe.mutex);
+            stripe.cells.erase(std::remove(stripe.cells.begin(), stripe.cells.end(), cell), stripe.cells.end());
+            cell->doc_ = nullptr;
+        }
+
+        bool hasTopLevel(const PathSegment& seg) const {
+            if (seg.isIndex)
+                return isSeq(root_) && seg.index < root_.sequence.size();
+            return isMap(root_) && root_.mapping.find(seg.key) != root_.mapping.end();
+        }
+
+        YamlNode* find(const std::vector<PathSegment>& segs) {
+            YamlNode* cur = &root_;
+            for (const PathSegment& seg : segs) {
+                if (seg.isIndex) {
+                    if (!isSeq(*cur) || seg.index >= cur->sequence.size())
+                        return nullptr;
+                    cur = &cur->sequence[seg.index];
+                } else {
+                    if (!isMap(*cur))
+                        return nullptr;
+                    auto it = cur->mapping.find(seg.key);
+                    if (it == cur->mapping.end())
+                        return nullptr;
+                    cur = &it->second;
                 }
             }
-        } break;
-        case YamlNodeType::Mapping: {
-            bool allScalar = std::all_of(node.mapping.begin(), node.mapping.end(), [](const auto& kv) {
-                return kv.second.type == YamlNodeType::Scalar && kv.second.style == ScalarStyle::Plain;
+            return cur;
+        }
+
+        // Run a writer on n; values derived from the old contents of n or any node below it are dropped.
+        template <class F> static void updateNode(YamlNode& n, F& fn) {
+            fn(n);
+            traverse(n, [](const YamlNode& node, const TraversalContext&) {
+                const_cast<YamlNode&>(node).clearAttachments(); // All of them sit below n, which is ours to change
+                return true;
             });
-            if (allScalar && node.mapping.size() <= 5) {
-                os << ind << "{";
-                bool first = true;
-                for (const auto& kv : node.mapping) {
-                    if (!first)
-                        os << ", ";
-                    os << kv.first << ": " << kv.second.scalarValue;
-                    first = false;
+        }
+
+        static YamlNode& resolve(YamlNode& root, const std::vector<PathSegment>& segs) {
+            YamlNode* cur = &root;
+            for (const PathSegment& seg : segs) {
+                YamlNodeType want = seg.isIndex ? YamlNodeType::Sequence : YamlNodeType::Mapping;
+                if (cur->type != want) {
+                    if (!isScalar(*cur) || !cur->scalarValue.empty())
+                        throw YamlError("Path steps through a value of a different type");
+                    *cur = YamlNode(want);
                 }
-                os << "}" << "\n";
-            } else {
-                for (const auto& kv : node.mapping) {
-                    os << ind << kv.first << ": ";
-                    if (kv.second.type == YamlNodeType::Scalar && kv.second.style == ScalarStyle::Plain) {
-                        os << kv.second.scalarValue << "\n";
-                    } else {
-                        os << "\n";
-                        emitYaml(kv.second, os, indent + 1);
-                    }
+                if (seg.isIndex) {
+                    if (seg.index > cur->sequence.size())
+                        throw YamlError("Sequence index out of range: " + std::to_string(seg.index));
+                    if (seg.index == cur->sequence.size())
+                        cur->sequence.emplace_back();
+                    cur = &cur->sequence[seg.index];
+                } else {
+                    cur = &cur->mapping[seg.key];
                 }
             }
-        } break;
+            return *cur;
         }
-    }
-    static std::string toYamlString(const YamlNode& node) {
-        std::ostringstream oss;
-        emitYaml(node, oss, 0);
-        return oss.str();
-    }
+
+        YamlNode root_;
+        mutable std::shared_mutex rootMutex_;
+        mutable std::array<Stripe, kStripes> stripes_;
+    };
 
     /**
-     * @brief Convenience loader returning a Document view.
+     * @brief Decoded value of one path in a ConcurrentDocument, kept current by the document.
+     *
+     * The value is decoded with NodeView::value semantics when the cell is bound and again
+     * whenever a write or reload touches the stripe owning the path; it is only republished if
+     * it actually changed. get() never walks the tree:
+     *  - lock-free trivially copyable T (int, double, bool, ...): one std::atomic<T> load;
+     *  - larger trivially copyable T: a seqlock over atomic words;
+     *  - anything else (std::string): an atomically swapped std::shared_ptr<const T>.
+     *
+     * The cell must be destroyed before its document, or after it (the document detaches its
+     * cells), but not concurrently with it.
      */
-    struct Document {
-        YamlNode root;
-        NodeView view() const { return NodeView{&root}; }
+    template <class T> class ConfigCell : public ConfigCellBase {
+      public:
+        ConfigCell(ConcurrentDocument& doc, std::string path, T def = T{})
+            : ConfigCellBase(std::move(path)), def_(std::move(def)) {
+            store_.store(def_);
+            attach(doc);
+        }
+        ~ConfigCell() override { detach(); }
+
+        T get() const { return store_.load(); }
+        operator T() const { return get(); }
+
+        /**
+         * @brief Number of times a refresh published a different value.
+         */
+        uint64_t changes() const { return changes_.load(std::memory_order_relaxed); }
+
+      private:
+        template <class U, bool = std::is_trivially_copyable_v<U>> struct IsLockFree : std::false_type {};
+        template <class U> struct IsLockFree<U, true> : std::bool_constant<std::atomic<U>::is_always_lock_free> {};
+
+        struct AtomicStore {
+            std::atomic<T> v;
+            T load() const { return v.load(std::memory_order_acquire); }
+            void store(const T& x) { v.store(x, std::memory_order_release); }
+        };
+        struct SeqlockStore {
+            static constexpr size_t kWords = (sizeof(T) + sizeof(uint64_t) - 1) / sizeof(uint64_t);
+            std::atomic<uint64_t> seq{0};
+            std::array<std::atomic<uint64_t>, kWords> words{};
+            T load() const {
+                uint64_t buf[kWords];
+                for (;;) {
+                    uint64_t before = seq.load(std::memory_order_acquire);
+                    if (before & 1)
+                        continue;
+                    for (size_t i = 0; i < kWords; ++i)
+                        buf[i] = words[i].load(std::memory_order_relaxed);
+                    std::atomic_thread_fence(std::memory_order_acquire);
+                    if (seq.load(std::memory_order_relaxed) == before)
+                        break;
+                }
+                T out;
+                std::memcpy(&out, buf, sizeof(T));
+                return out;
+            }
+            void store(const T& x) {
+                uint64_t buf[kWords] = {};
+                std::memcpy(buf, &x, sizeof(T));
+                seq.fetch_add(1, std::memory_order_relaxed);
+                std::atomic_thread_fence(std::memory_order_release);
+                for (size_t i = 0; i < kWords; ++i)
+                    words[i].store(buf[i], std::memory_order_relaxed);
+                seq.fetch_add(1, std::memory_order_release);
+            }
+        };
+        struct SharedStore {
+            std::shared_ptr<const T> v;
+            T load() const { return *std::atomic_load_explicit(&v, std::memory_order_acquire); }
+            void store(const T& x) {
+                std::atomic_store_explicit(&v, std::make_shared<const T>(x), std::memory_order_release);
+            }
+        };
+        using Store = std::conditional_t<IsLockFree<T>::value, AtomicStore,
+                                         std::conditional_t<std::is_trivially_copyable_v<T>, SeqlockStore, SharedStore>>;
+
+        void refresh(NodeView v) override {
+            T next = v ? v.value<T>("", def_) : def_;
+            if (next == store_.load())
+                return;
+            store_.store(next);
+            changes_.fetch_add(1, std::memory_order_relaxed);
+        }
+
+        T def_;
+        Store store_;
+        std::atomic<uint64_t> changes_{0};
     };
-    static Document loadFile(const std::string& filename) { return Document{parseFile(filename)}; }
-    static Document loadString(const std::string& text) { return Document{parse(text)}; }
 
     /**
      * @brief Trim leading/trailing whitespace.
@@ -473,6 +5668,38 @@ class YamlParser {
     }
 
   private:
+    static constexpr char kIndexMagic[5] = "YIDX";
+    static constexpr uint32_t kIndexVersion = 1;
+
+    /**
+     * @brief Record the size and modification time that validate an index for filename.
+     */
+    static void stampIndex(OffsetIndex& idx, const std::string& filename) {
+        std::error_code ec;
+        auto size = std::filesystem::file_size(filename, ec);
+        if (ec)
+            throw YamlError("Cannot stat file: " + filename);
+        auto mtime = std::filesystem::last_write_time(filename, ec);
+        if (ec)
+            throw YamlError("Cannot stat file: " + filename);
+        idx.fileSize = size;
+        idx.mtime = static_cast<int64_t>(mtime.time_since_epoch().count());
+    }
+
+    /**
+     * @brief Read length bytes at offset without touching the rest of the file.
+     */
+    static std::string readSlice(const std::string& filename, uint64_t offset, uint64_t length) {
+        std::ifstream in(filename, std::ios::binary);
+        if (!in.is_open())
+            throw YamlError("Cannot open file: " + filename);
+        std::string buf(length, '\0');
+        in.seekg(static_cast<std::streamoff>(offset));
+        if (!in.read(buf.data(), static_cast<std::streamsize>(length)))
+            throw YamlError("Index out of date or file truncated: " + filename);
+        return buf;
+    }
+
     /**
      * @brief Get indentation level, throwing on tabs.
      * @throws YamlError if tabs detected.
@@ -507,7 +5734,67 @@ class YamlParser {
     }
 
     /**
-     * @brief Unescape quoted strings (basic: \n, \t, \\, \', \").
+     * @brief Position of the '#' that starts a comment, or npos. A '#' inside a quoted scalar is text.
+     *
+     * A quote opens a quoted scalar only at the start of a token (line start, or after a blank,
+     * ':', ',', '[' or '{'), so apostrophes in plain text do not hide a later comment.
+     */
+    static size_t findComment(std::string_view line) {
+        size_t hash = line.find('#');
+        if (hash == std::string_view::npos || line.find_first_of("\"'") > hash)
+            return hash;
+        for (size_t i = 0; i < line.size(); ++i) {
+            char c = line[i];
+            if (c == '#')
+                return i;
+            if ((c == '"' || c == '\'') && (i == 0 || std::string_view(" \t:,[{").find(line[i - 1]) != std::string_view::npos)) {
+                size_t close = findClosingQuote(line, i);
+                if (close == std::string_view::npos)
+                    return std::string_view::npos;
+                i = close;
+            }
+        }
+        return std::string_view::npos;
+    }
+
+    /**
+     * @brief Position of the quote closing the one at s[open] (skipping \" or ''), or npos.
+     */
+    static size_t findClosingQuote(std::string_view s, size_t open) {
+        char q = s[open];
+        for (size_t i = open + 1; i < s.size(); ++i) {
+            if (q == '"' && s[i] == '\\') {
+                ++i;
+            } else if (s[i] == q) {
+                if (q == '\'' && i + 1 < s.size() && s[i + 1] == '\'') {
+                    ++i;
+                    continue;
+                }
+                return i;
+            }
+        }
+        return std::string_view::npos;
+    }
+
+    /**
+     * @brief True if s is exactly one quoted scalar ("..." or '...').
+     */
+    static bool isQuotedScalar(std::string_view s) {
+        return s.size() > 1 && (s[0] == '"' || s[0] == '\'') && findClosingQuote(s, 0) == s.size() - 1;
+    }
+
+    /**
+     * @brief True if line is a "---" or "..." document marker: at column 0 and followed by nothing,
+     * whitespace or a comment. Lines such as "----" or "---x: 1" are content.
+     */
+    static bool isDocumentMarker(std::string_view line) {
+        if (line.size() < 3 || (line.compare(0, 3, "---") != 0 && line.compare(0, 3, "...") != 0))
+            return false;
+        return line.size() == 3 || line[3] == ' ' || line[3] == '\t' || line[3] == '\r' || line[3] == '#';
+    }
+
+    /**
+     * @brief Unescape quoted strings (basic: \n, \t, \r, \0, \xHH, \\, \', \").
      */
     static std::string unescape(const std::string& s) {
         std::string result;
@@ -520,6 +5807,21 @@ class YamlParser {
                 case 't':
                     result += '\t';
                     break;
+                case 'r':
+                    result += '\r';
+                    break;
+                case '0':
+                    result += '\0';
+                    break;
+                case 'x':
+                    if (i + 2 < s.size() && std::isxdigit(static_cast<unsigned char>(s[i + 1])) &&
+                        std::isxdigit(static_cast<unsigned char>(s[i + 2]))) {
+                        result += static_cast<char>(std::stoi(s.substr(i + 1, 2), nullptr, 16));
+                        i += 2;
+                    } else {
+                        result += 'x';
+                    }
+                    break;
                 case '\\':
                     result += '\\';
                     break;
@@ -552,10 +5854,11 @@ class YamlParser {
         while (std::getline(iss, item, ',')) {
             std::string val = trim(item);
             if (!val.empty()) {
+                YamlNode node(YamlNodeType::Scalar);
                 if ((val[0] == '"' || val[0] == '\'') && val.size() > 1 && val.back() == val[0]) {
                     val = unescape(val.substr(1, val.size() - 2));
+                    node.style = ScalarStyle::Quoted;
                 }
-                YamlNode node(YamlNodeType::Scalar);
                 node.scalarValue = val;
                 seq.sequence.push_back(node);
             }
@@ -583,10 +5886,11 @@ class YamlParser {
             if (key.empty()) {
                 throw YamlError("Empty key in flow mapping", lineNum);
             }
+            YamlNode node(YamlNodeType::Scalar);
             if ((val[0] == '"' || val[0] == '\'') && val.size() > 1 && val.back() == val[0]) {
                 val = unescape(val.substr(1, val.size() - 2));
+                node.style = ScalarStyle::Quoted;
             }
-            YamlNode node(YamlNodeType::Scalar);
             node.scalarValue = val;
             map.mapping[key] = node;
         }
@@ -608,9 +5912,6 @@ class YamlParser {
 
         while (std::getline(input, line)) {
             ++lineNum;
-            size_t commentPos = line.find('#');
-            if (commentPos != std::string::npos)
-                line.resize(commentPos);
             int nextIndent = getIndent(line, lineNum);
             std::string trimmed = trim(line);
             if (trimmed.empty()) {
@@ -699,26 +6000,219 @@ class YamlParser {
         return folded;
     }
 
+    // ---- Parse statistics ----
+
+    enum class ParsePhase { Scan, BlockScalar, Flow, Build };
+
+    /**
+     * @brief Charges the time since the last switch to the phase being left. Inert without stats.
+     */
+    class PhaseClock {
+      public:
+        explicit PhaseClock(ParseStats* stats) : stats_(stats) {
+            if (stats_)
+                last_ = std::chrono::steady_clock::now();
+        }
+        ~PhaseClock() { enter(ParsePhase::Build); }
+        void enter(ParsePhase phase) {
+            if (!stats_)
+                return;
+            auto now = std::chrono::steady_clock::now();
+            slot(current_) += now - last_;
+            last_ = now;
+            current_ = phase;
+        }
+
+      private:
+        std::chrono::nanoseconds& slot(ParsePhase phase) {
+            switch (phase) {
+            case ParsePhase::Scan:
+                return stats_->scanTime;
+            case ParsePhase::BlockScalar:
+                return stats_->blockScalarTime;
+            case ParsePhase::Flow:
+                return stats_->flowTime;
+            default:
+                return stats_->buildTime;
+            }
+        }
+
+        ParseStats* stats_;
+        ParsePhase current_ = ParsePhase::Build;
+        std::chrono::steady_clock::time_point last_;
+    };
+
+    /**
+     * @brief Resets stats at the start of a top-level parse and adds the tree-wide figures at the end.
+     */
+    class StatsSession {
+      public:
+        explicit StatsSession(ParseStats* stats) : stats_(stats) {
+            if (stats_) {
+                *stats_ = ParseStats{};
+                start_ = std::chrono::steady_clock::now();
+            }
+        }
+        void finish(const YamlNode& root) {
+            if (!stats_)
+                return;
+            stats_->totalTime = std::chrono::steady_clock::now() - start_;
+            // Whatever the phase clocks did not claim went into wiring up the tree
+            stats_->buildTime =
+                stats_->totalTime - stats_->scanTime - stats_->blockScalarTime - stats_->flowTime;
+            collectTreeStats(root, *stats_);
+        }
+
+      private:
+        ParseStats* stats_;
+        std::chrono::steady_clock::time_point start_;
+    };
+
+    static void collectTreeStats(const YamlNode& root, ParseStats& stats) {
+        // A std::map entry is one heap block: the key/value pair plus the red-black tree links
+        constexpr size_t kMapEntryBytes = sizeof(std::pair<const std::string, YamlNode>) + 4 * sizeof(void*);
+        auto countString = [&stats](const std::string& s) {
+            const char* object = reinterpret_cast<const char*>(&s);
+            if (s.data() < object || s.data() >= object + sizeof(s)) { // Not in the small-string buffer
+                ++stats.allocations;
+                stats.allocatedBytes += s.capacity() + 1;
+            }
+        };
+        traverse(root, [&](const YamlNode& n, const TraversalContext& ctx) {
+            stats.maxDepth = std::max(stats.maxDepth, ctx.depth);
+            countString(n.scalarValue);
+            switch (n.type) {
+            case YamlNodeType::Scalar:
+                ++stats.scalars;
+                stats.scalarBytes += n.scalarValue.size();
+                break;
+            case YamlNodeType::Sequence:
+                ++stats.sequences;
+                break;
+            case YamlNodeType::Mapping:
+                ++stats.mappings;
+                break;
+            }
+            if (n.sequence.capacity()) {
+                ++stats.allocations;
+                stats.allocatedBytes += n.sequence.capacity() * sizeof(YamlNode);
+            }
+            for (const auto& kv : n.mapping) {
+                ++stats.allocations;
+                stats.allocatedBytes += kMapEntryBytes;
+                countString(kv.first);
+            }
+            return true;
+        });
+    }
+
+    static size_t countLines(std::string_view text) {
+        size_t n = static_cast<size_t>(std::count(text.begin(), text.end(), '\n'));
+        return n + (!text.empty() && text.back() != '\n');
+    }
+
+    static size_t jsonNestingDepth(const YamlNode& root) {
+        size_t depth = 0;
+        traverse(root, [&depth](const YamlNode& n, const TraversalContext& ctx) {
+            if (n.type != YamlNodeType::Scalar)
+                depth = std::max(depth, ctx.depth + 1);
+            return n.type != YamlNodeType::Scalar;
+        });
+        return depth;
+    }
+
+    static uint64_t fileSizeOrZero(const std::string& filename) {
+        std::error_code ec;
+        uint64_t size = std::filesystem::file_size(filename, ec);
+        return ec ? 0 : size;
+    }
+
+    /**
+     * @brief parse() without the stats bookkeeping, so parseStream can hand JSON text over.
+     */
+    static YamlNode parseText(const std::string& input, ParseStats* stats) {
+        if (stats) {
+            stats->bytes = input.size();
+            stats->lines = countLines(input);
+        }
+        if (looksLikeJson(input)) {
+            try {
+                YAML_TRACE_SCOPE(trace, "json", input.size());
+                PhaseClock clock(stats);
+                clock.enter(ParsePhase::Flow);
+                YamlNode root = parseJson(input);
+                clock.enter(ParsePhase::Build);
+                if (stats)
+                    stats->peakStackDepth = jsonNestingDepth(root);
+                return root;
+            } catch (const YamlError&) {
+                // Not JSON after all (e.g. a YAML flow collection); use the YAML parser
+            }
+        }
+        std::stringstream ss(input);
+        return parseLines(ss, stats);
+    }
+
+    /**
+     * @brief Parse a stream, routing JSON input (first non-blank byte '{' or '[') to parseJson.
+     */
+    static YamlNode parseStream(std::istream& input, ParseStats* stats = nullptr) {
+        std::streampos start = input.tellg();
+        if (stats) {
+            input.seekg(0, std::ios::end);
+            std::streampos end = input.tellg();
+            stats->bytes = end > start ? static_cast<size_t>(end - start) : 0;
+            input.seekg(start);
+        }
+        int first = input.peek();
+        while (first == ' ' || first == '\t' || first == '\r' || first == '\n') {
+            input.get();
+            first = input.peek();
+        }
+        input.seekg(start); // The line parser counts lines from the top
+        if (first != '{' && first != '[')
+            return parseLines(input, stats);
+        std::string text;
+        {
+            YAML_TRACE_SCOPE(trace, "read", 0);
+            text.assign(std::istreambuf_iterator<char>(input), std::istreambuf_iterator<char>());
+            YAML_TRACE_BYTES(trace, text.size());
+        }
+        return parseText(text, stats);
+    }
+
     /**
-     * @brief Core parser from input stream.
+     * @brief Core line-oriented YAML parser from input stream.
      */
-    static YamlNode parseStream(std::istream& input) {
+    static YamlNode parseLines(std::istream& input, ParseStats* stats = nullptr) {
         YamlNode root(YamlNodeType::Mapping);
         std::string line;
         std::vector<std::pair<YamlNode*, int>> stack = {{&root, -1}};
         YamlNode* lastScalarNode = nullptr;
         int lastScalarIndent = -1;
         int linecount{0};
+        PhaseClock clock(stats);
+        auto pushCollection = [&](YamlNode* node, int indent) {
+            stack.push_back({node, indent});
+            if (stats)
+                stats->peakStackDepth = std::max(stats->peakStackDepth, stack.size());
+        };
+        if (stats)
+            stats->peakStackDepth = 1;
 
-        while (std::getline(input, line)) {
+        for (;;) {
+            clock.enter(ParsePhase::Scan);
+            if (!std::getline(input, line))
+                break;
             ++linecount;
-            if (size_t commentPos = line.find('#'); commentPos != std::string::npos)
+            if (size_t commentPos = findComment(line); commentPos != std::string::npos)
                 line.resize(commentPos);
             if (line.empty() || trim(line).empty())
                 continue;
 
             int indent = getIndent(line, linecount);
             std::string content = trim(line.substr(indent));
+            clock.enter(ParsePhase::Build);
 
             // If we did not indent deeper than the scalar line, the scalar is complete; allow new sibling keys.
             if (lastScalarNode && indent <= lastScalarIndent) {
@@ -750,7 +6244,11 @@ class YamlParser {
 
                 if (!itemValue.empty()) {
                     size_t colonPos = itemValue.find(':');
-                    if (colonPos != std::string::npos) {
+                    if (isQuotedScalar(itemValue)) {
+                        item.type = YamlNodeType::Scalar;
+                        item.style = ScalarStyle::Quoted;
+                        item.scalarValue = unescape(itemValue.substr(1, itemValue.size() - 2));
+                    } else if (colonPos != std::string::npos) {
                         std::string key = trim(itemValue.substr(0, colonPos));
                         std::string val = trim(itemValue.substr(colonPos + 1));
                         item.type = YamlNodeType::Mapping;
@@ -768,10 +6266,16 @@ class YamlParser {
 
                 currentNode->sequence.push_back(item);
                 if (item.type == YamlNodeType::Mapping && itemValue.empty()) {
-                    stack.push_back({&currentNode->sequence.back(), indent});
+                    pushCollection(&currentNode->sequence.back(), indent);
                 }
             } else {
                 size_t colonPos = content.find(':');
+                if (content[0] == '"' || content[0] == '\'') {
+                    // Quoted key: its ':' is the first one after the closing quote
+                    size_t close = findClosingQuote(content, 0);
+                    if (close != std::string::npos)
+                        colonPos = content.find(':', close + 1);
+                }
                 if (colonPos == std::string::npos) {
                     if (lastScalarNode) {
                         lastScalarNode->scalarValue += "\n" + trim(line);
@@ -789,6 +6293,9 @@ class YamlParser {
                 if (key.empty()) {
                     throw YamlError("Invalid mapping format (empty key): " + content, linecount);
                 }
+                if (isQuotedScalar(key)) {
+                    key = unescape(key.substr(1, key.size() - 2));
+                }
 
                 if (currentNode->type != YamlNodeType::Mapping) {
                     currentNode->type = YamlNodeType::Mapping;
@@ -808,13 +6315,17 @@ class YamlParser {
                         } else {
                             value = value.substr(1);
                         }
+                        clock.enter(ParsePhase::BlockScalar);
+                        YAML_TRACE_SCOPE(trace, "block scalar", 0);
                         std::string block = parseBlockScalar(indent, linecount, input);
+                        YAML_TRACE_BYTES(trace, block.size());
                         newNode.type = YamlNodeType::Scalar;
                         newNode.style = (indicator == '|' ? ScalarStyle::Literal : ScalarStyle::Folded);
                         if (newNode.style == ScalarStyle::Folded) {
                             block = foldBlock(block);
                         }
                         newNode.scalarValue = applyChomp(block, chomp);
+                        clock.enter(ParsePhase::Build);
                         currentNode->mapping[key] = newNode;
                         lastScalarNode = nullptr;
                         lastScalarIndent = -1;
@@ -832,18 +6343,26 @@ class YamlParser {
                         }
                     }
 
-                    // Check for ambiguous colon in unquoted value
-                    if (!wasQuoted && value.find(": ") != std::string::npos) {
-                        throw YamlError("Unquoted value contains ': ' - use quotes to avoid ambiguity", linecount);
-                    }
-
-                    // Handle flow styles (after potential quote strip)
-                    value = trim(value); // Re-trim after unescape
-                    if (value[0] == '[' && value.back() == ']') {
+                    // Handle flow styles; quoted text is kept verbatim
+                    if (wasQuoted) {
+                        newNode.type = YamlNodeType::Scalar;
+                        newNode.style = ScalarStyle::Quoted;
+                        newNode.scalarValue = value;
+                    } else if (value[0] == '[' && value.back() == ']') {
+                        YAML_TRACE_SCOPE(trace, "flow sequence", value.size());
+                        clock.enter(ParsePhase::Flow);
                         newNode = parseFlowSequence(value.substr(1, value.size() - 2), linecount);
+                        clock.enter(ParsePhase::Build);
                     } else if (value[0] == '{' && value.back() == '}') {
+                        YAML_TRACE_SCOPE(trace, "flow mapping", value.size());
+                        clock.enter(ParsePhase::Flow);
                         newNode = parseFlowMapping(value.substr(1, value.size() - 2), linecount);
+                        clock.enter(ParsePhase::Build);
                     } else {
+                        // Check for ambiguous colon in unquoted value
+                        if (value.find(": ") != std::string::npos) {
+                            throw YamlError("Unquoted value contains ': ' - use quotes to avoid ambiguity", linecount);
+                        }
                         newNode.type = YamlNodeType::Scalar;
                         newNode.scalarValue = value;
                     }
@@ -864,13 +6383,15 @@ class YamlParser {
                     }
                     newNode.type = inferredType;
                     currentNode->mapping[key] = newNode;
-                    stack.push_back({&currentNode->mapping[key], indent});
+                    pushCollection(&currentNode->mapping[key], indent);
                     lastScalarNode = nullptr;
                     lastScalarIndent = -1;
                 }
             }
         }
 
+        if (stats)
+            stats->lines = static_cast<size_t>(linecount);
         return root;
     }
 };
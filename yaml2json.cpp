@@ -0,0 +1,37 @@
+// Convert YAML streams to NDJSON: one compact JSON line per document, without building trees.
+//
+// Usage:
+//   yaml2json [file.yaml ...]    read the files in order, or stdin when none are given
+
+#include <cstdio>
+#include <fstream>
+#include <iostream>
+
+#include "BasicYamlParser.hpp"
+
+int main(int argc, char** argv) {
+    auto sink = [](const char* p, size_t n) {
+        if (std::fwrite(p, 1, n, stdout) != n)
+            throw YamlError("write to stdout failed");
+    };
+    try {
+        std::ios::sync_with_stdio(false);
+        if (argc < 2) {
+            YamlParser::transcodeToNdjson(std::cin, sink);
+        }
+        for (int i = 1; i < argc; ++i) {
+            std::ifstream in(argv[i], std::ios::binary);
+            if (!in.is_open())
+                throw YamlError(std::string("Cannot open file: ") + argv[i]);
+            YamlParser::transcodeToNdjson(in, sink);
+        }
+    } catch (const YamlError& e) {
+        std::fflush(stdout);
+        std::cerr << "Error";
+        if (e.line > 0)
+            std::cerr << " (line " << e.line << ")";
+        std::cerr << ": " << e.what() << std::endl;
+        return 1;
+    }
+    return std::fflush(stdout) == 0 ? 0 : 1;
+}
@@ -0,0 +1,599 @@
+// Micro-benchmarks for BasicYamlParser.hpp.
+//
+// Usage: yaml_bench [name]   (runs every benchmark when no name is given)
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstring>
+#include <functional>
+#include <iomanip>
+#include <iostream>
+#include <map>
+#include <shared_mutex>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#include "BasicYamlParser.hpp"
+
+using Clock = std::chrono::steady_clock;
+
+static double secondsSince(Clock::time_point start) {
+    return std::chrono::duration<double>(Clock::now() - start).count();
+}
+
+// Run fn(threadIndex) on `threads` threads and return the elapsed wall time.
+static double runThreads(int threads, const std::function<void(int)>& fn) {
+    std::vector<std::thread> pool;
+    auto start = Clock::now();
+    for (int t = 0; t < threads; ++t)
+        pool.emplace_back(fn, t);
+    for (auto& th : pool)
+        th.join();
+    return secondsSince(start);
+}
+
+// Writers update disjoint top-level subtrees while the same number of readers poll them.
+// Compares the striped ConcurrentDocument against one document-wide shared_mutex.
+static void benchContention() {
+    const int opsPerThread = 20000;
+    std::cout << "== contention: disjoint writers + readers, " << opsPerThread << " ops/thread\n";
+    std::cout << "threads   global-lock Mops/s   striped Mops/s\n";
+    for (int threads = 1; threads <= 64; threads *= 2) {
+        auto pathFor = [](int t) { return "svc" + std::to_string(t) + ".counter"; };
+        auto bump = [](YamlNode& n) { n.scalarValue = std::to_string(YamlParser::toInt(n).value_or(0) + 1); };
+
+        YamlNode plain(YamlNodeType::Mapping);
+        std::shared_mutex globalMutex;
+        for (int t = 0; t < threads; ++t) {
+            YamlNode& svc = plain.mapping["svc" + std::to_string(t)];
+            svc.type = YamlNodeType::Mapping;
+            svc.mapping["counter"].scalarValue = "0";
+        }
+        double globalSecs = runThreads(threads * 2, [&](int idx) {
+            std::string path = pathFor(idx % threads);
+            for (int i = 0; i < opsPerThread; ++i) {
+                if (idx < threads) {
+                    std::unique_lock<std::shared_mutex> lock(globalMutex);
+                    bump(const_cast<YamlNode&>(*YamlParser::NodeView{&plain}.at_path(path).n));
+                } else {
+                    std::shared_lock<std::shared_mutex> lock(globalMutex);
+                    (void)YamlParser::NodeView{&plain}.value<int>(path, 0);
+                }
+            }
+        });
+
+        YamlParser::ConcurrentDocument doc;
+        for (int t = 0; t < threads; ++t)
+            doc.set(pathFor(t), "0");
+        double stripedSecs = runThreads(threads * 2, [&](int idx) {
+            std::string path = pathFor(idx % threads);
+            for (int i = 0; i < opsPerThread; ++i) {
+                if (idx < threads)
+                    doc.update(path, bump);
+                else
+                    (void)doc.value<int>(path, 0);
+            }
+        });
+
+        double totalOps = 2.0 * threads * opsPerThread / 1e6;
+        std::cout << std::setw(7) << threads << std::setw(21) << std::fixed << std::setprecision(2)
+                  << totalOps / globalSecs << std::setw(17) << totalOps / stripedSecs << "\n";
+    }
+}
+
+// Synthetic ETL work per record: enough arithmetic that processing costs about as much as parsing.
+static long long processRecord(const YamlParser::Record& rec) {
+    long long acc = rec.doc.view()["latency_ms"].to_int().value_or(0);
+    for (int i = 0; i < 2000; ++i)
+        acc = acc * 6364136223846793005LL + 1442695040888963407LL;
+    return acc;
+}
+
+// Parse-then-process versus the parser/consumer pipeline.
+static void benchPipeline() {
+    const int records = 100000;
+    std::string text;
+    for (int i = 0; i < records; ++i)
+        text += "- ts: " + std::to_string(1700000000 + i) + "\n  host: h" + std::to_string(i % 64) +
+                "\n  latency_ms: " + std::to_string(i % 997) + "\n  status: 200\n";
+    std::cout << "== pipeline: " << records << " records (" << text.size() / (1024 * 1024) << " MB)\n";
+
+    std::istringstream serialIn(text);
+    auto start = Clock::now();
+    std::vector<YamlParser::Record> all;
+    YamlParser::forEachRecord(serialIn, [&](YamlParser::Record& rec) { all.push_back(std::move(rec)); });
+    long long serialSum = 0;
+    for (const auto& rec : all)
+        serialSum += processRecord(rec);
+    double serialSecs = secondsSince(start);
+    std::cout << "parse, then process:  " << std::fixed << std::setprecision(3) << serialSecs << " s\n";
+
+    for (size_t consumers : {1u, 2u, 4u, 8u}) {
+        std::istringstream in(text);
+        std::atomic<long long> sum{0};
+        start = Clock::now();
+        YamlParser::processRecordsParallel(in, consumers,
+                                           [&](YamlParser::Record& rec) { sum += processRecord(rec); });
+        double secs = secondsSince(start);
+        std::cout << "pipeline, " << consumers << " consumer(s): " << secs << " s"
+                  << (sum.load() == serialSum ? "" : "  (checksum mismatch!)") << "\n";
+    }
+}
+
+// A mapping of `entries` services, each with a few scalars, a list and a literal block.
+static YamlNode makeLargeTree(int entries) {
+    YamlNode root(YamlNodeType::Mapping);
+    for (int i = 0; i < entries; ++i) {
+        YamlNode& svc = root.mapping["service_" + std::to_string(i)];
+        svc.type = YamlNodeType::Mapping;
+        for (int f = 0; f < 8; ++f)
+            svc.mapping["field_" + std::to_string(f)].scalarValue = "value number " + std::to_string(i * 8 + f);
+        YamlNode& hosts = svc.mapping["hosts"];
+        hosts.type = YamlNodeType::Sequence;
+        for (int h = 0; h < 8; ++h) {
+            hosts.sequence.emplace_back(YamlNodeType::Scalar);
+            hosts.sequence.back().scalarValue = "host-" + std::to_string(h) + ".example.com";
+        }
+        YamlNode& script = svc.mapping["script"];
+        script.style = ScalarStyle::Literal;
+        script.scalarValue = "set -e\nrun --fast\nrun --slow\n";
+    }
+    return root;
+}
+
+// Throughput of the buffered emitter into a string, a chunked sink, an ostream, and on several threads.
+static void benchEmit() {
+    YamlNode root = makeLargeTree(50000);
+    auto start = Clock::now();
+    std::string yaml = YamlParser::toYamlString(root);
+    double stringSecs = secondsSince(start);
+    double mb = yaml.size() / (1024.0 * 1024.0);
+    std::cout << "== emit: " << std::fixed << std::setprecision(1) << mb << " MB of YAML\n";
+    std::cout << "toYamlString:        " << mb / stringSecs << " MB/s\n";
+
+    size_t bytes = 0;
+    start = Clock::now();
+    YamlParser::emitYaml(root, [&](const char*, size_t n) { bytes += n; });
+    std::cout << "emitYaml(sink):      " << mb / secondsSince(start) << " MB/s\n";
+
+    std::ostringstream os;
+    start = Clock::now();
+    YamlParser::emitYaml(root, os);
+    std::cout << "emitYaml(ostream):   " << mb / secondsSince(start) << " MB/s\n";
+
+    for (size_t threads : {1u, 2u, 4u, 8u}) {
+        start = Clock::now();
+        std::string parallel = YamlParser::toYamlStringParallel(root, threads);
+        double secs = secondsSince(start);
+        std::cout << "parallel, " << threads << " thread(s): " << std::setw(6) << mb / secs << " MB/s"
+                  << (parallel == yaml ? "" : "  (output mismatch!)") << "\n";
+    }
+}
+
+// JSON emission throughput, compact and pretty, into a string and a chunked sink.
+static void benchJson() {
+    YamlNode root = makeLargeTree(50000);
+    YamlParser::JsonOptions compact, pretty;
+    pretty.pretty = true;
+    auto start = Clock::now();
+    std::string json = YamlParser::toJsonString(root, compact);
+    double secs = secondsSince(start);
+    double mb = json.size() / (1024.0 * 1024.0);
+    std::cout << "== json: " << std::fixed << std::setprecision(1) << mb << " MB compact\n";
+    std::cout << "toJsonString(compact): " << mb / secs << " MB/s\n";
+
+    start = Clock::now();
+    json = YamlParser::toJsonString(root, pretty);
+    secs = secondsSince(start);
+    std::cout << "toJsonString(pretty):  " << json.size() / (1024.0 * 1024.0) / secs << " MB/s\n";
+
+    size_t bytes = 0;
+    start = Clock::now();
+    YamlParser::emitJson(root, [&](const char*, size_t n) { bytes += n; }, compact);
+    std::cout << "emitJson(sink):        " << bytes / (1024.0 * 1024.0) / secondsSince(start) << " MB/s\n";
+}
+
+// Parsing the same tree as minified JSON (fast path), pretty JSON, and block YAML (line parser).
+static void benchJsonParse() {
+    YamlNode root = makeLargeTree(20000);
+    YamlParser::JsonOptions pretty;
+    pretty.pretty = true;
+    const std::pair<const char*, std::string> inputs[] = {
+        {"minified JSON", YamlParser::toJsonString(root)},
+        {"pretty JSON  ", YamlParser::toJsonString(root, pretty)},
+        {"block YAML   ", YamlParser::toYamlString(root)},
+    };
+    std::cout << "== json parse: " << root.mapping.size() << " services\n";
+    for (const auto& [name, text] : inputs) {
+        auto start = Clock::now();
+        YamlNode parsed = YamlParser::parse(text);
+        double secs = secondsSince(start);
+        std::cout << name << std::fixed << std::setprecision(1) << std::setw(8)
+                  << text.size() / (1024.0 * 1024.0) / secs << " MB/s"
+                  << (parsed.mapping.size() == root.mapping.size() ? "" : "  (wrong result!)") << "\n";
+    }
+}
+
+// Scalar classification and escaping against a plain memcpy of the same bytes.
+static void benchQuoting() {
+    std::vector<std::string> values;
+    for (int i = 0; i < 64 * 1024; ++i) {
+        std::string v;
+        while (v.size() < 1000)
+            v += "lorem ipsum dolor sit amet " + std::to_string(i) + " ";
+        v.pop_back();
+        values.push_back(std::move(v));
+    }
+    double mb = values.size() * values[0].size() / (1024.0 * 1024.0);
+    std::cout << "== quoting: " << std::fixed << std::setprecision(1) << mb << " MB of ~1 KB clean scalars\n";
+
+    std::vector<char> dst(values[0].size() + 64);
+    auto start = Clock::now();
+    volatile char sink = 0; // Keeps the copies observable
+    for (const auto& v : values) {
+        std::memcpy(dst.data(), v.data(), v.size());
+        sink = dst[v.size() / 2];
+    }
+    (void)sink;
+    std::cout << "memcpy:              " << mb / secondsSince(start) << " MB/s\n";
+
+    start = Clock::now();
+    size_t quoted = 0;
+    for (const auto& v : values)
+        quoted += YamlParser::scalarNeedsQuotes(v);
+    std::cout << "scalarNeedsQuotes:   " << mb / secondsSince(start) << " MB/s (" << quoted << " quoted)\n";
+
+    std::string out;
+    start = Clock::now();
+    for (const auto& v : values) {
+        out.clear();
+        YamlParser::StringOutput o{out};
+        YamlParser::writeQuoted(o, v);
+    }
+    std::cout << "writeQuoted:         " << mb / secondsSince(start) << " MB/s\n";
+}
+
+// MessagePack encode/decode against emitting and parsing the same tree as YAML.
+static void benchMsgPack() {
+    YamlNode root = makeLargeTree(20000);
+    auto start = Clock::now();
+    std::string yaml = YamlParser::toYamlString(root);
+    double emitSecs = secondsSince(start);
+    start = Clock::now();
+    YamlNode parsed = YamlParser::parse(yaml);
+    double parseSecs = secondsSince(start);
+
+    start = Clock::now();
+    std::string bin = YamlParser::toMsgPack(root);
+    double encodeSecs = secondsSince(start);
+    start = Clock::now();
+    YamlNode decoded = YamlParser::fromMsgPack(bin);
+    double decodeSecs = secondsSince(start);
+
+    std::cout << "== msgpack: " << root.mapping.size() << " services, " << std::fixed << std::setprecision(1)
+              << yaml.size() / (1024.0 * 1024.0) << " MB YAML, " << bin.size() / (1024.0 * 1024.0)
+              << " MB MessagePack\n";
+    std::cout << std::setprecision(3) << "toYamlString: " << emitSecs << " s   toMsgPack:   " << encodeSecs << " s\n"
+              << "parse:        " << parseSecs << " s   fromMsgPack: " << decodeSecs << " s"
+              << (decoded.mapping.size() == parsed.mapping.size() ? "" : "  (wrong result!)") << "\n";
+}
+
+// Summing one field through NodeView lookups against extracting columns once and scanning arrays.
+static void benchColumns() {
+    const int records = 1000000;
+    YamlNode recs(YamlNodeType::Sequence);
+    recs.sequence.reserve(records);
+    for (int i = 0; i < records; ++i) {
+        YamlNode& r = recs.sequence.emplace_back(YamlNodeType::Mapping);
+        r.mapping["ts"].scalarValue = std::to_string(1700000000 + i);
+        r.mapping["host"].scalarValue = "h" + std::to_string(i % 64);
+        r.mapping["latency_ms"].scalarValue = std::to_string(i % 997);
+        r.mapping["status"].scalarValue = "200";
+    }
+    std::cout << "== columns: " << records << " records\n";
+
+    auto start = Clock::now();
+    long long viewSum = 0;
+    YamlParser::NodeView root{&recs};
+    for (size_t i = 0; i < recs.sequence.size(); ++i)
+        viewSum += root[i]["latency_ms"].to_int().value_or(0);
+    std::cout << "NodeView per field:   " << std::fixed << std::setprecision(3) << secondsSince(start) << " s\n";
+
+    const std::vector<YamlParser::ColumnSpec> specs = {{"ts", YamlParser::ColumnType::Int},
+                                                       {"host", YamlParser::ColumnType::String},
+                                                       {"latency_ms", YamlParser::ColumnType::Int},
+                                                       {"status", YamlParser::ColumnType::Int}};
+    for (size_t threads : {1u, 2u, 4u}) {
+        start = Clock::now();
+        auto table = YamlParser::extractColumns(recs, specs, threads);
+        double extractSecs = secondsSince(start);
+        start = Clock::now();
+        long long sum = 0;
+        for (long long v : table.at("latency_ms").ints)
+            sum += v;
+        std::cout << "extract, " << threads << " thread(s): " << extractSecs << " s, scan " << secondsSince(start)
+                  << " s" << (sum == viewSum ? "" : "  (checksum mismatch!)") << "\n";
+    }
+}
+
+// A filter/sort/group pipeline over 20k resources: hand-written loops against a compiled Query.
+static void benchQuery() {
+    const int resources = 20000;
+    YamlNode seq(YamlNodeType::Sequence);
+    for (int i = 0; i < resources; ++i) {
+        YamlNode& r = seq.sequence.emplace_back(YamlNodeType::Mapping);
+        r.mapping["name"].scalarValue = "pod-" + std::to_string(i);
+        r.mapping["node"].scalarValue = "node-" + std::to_string(i % 50);
+        r.mapping["restarts"].scalarValue = std::to_string((i * 7919) % 23);
+    }
+    YamlParser::NodeView view{&seq};
+    const int reps = 20;
+    std::cout << "== query: " << resources << " resources, " << reps << " runs\n";
+
+    auto start = Clock::now();
+    size_t handGroups = 0;
+    for (int rep = 0; rep < reps; ++rep) {
+        std::vector<YamlParser::NodeView> hits;
+        for (size_t i = 0; i < view.as_seq().size(); ++i)
+            if (view[i]["restarts"].to_int().value_or(0) > 10)
+                hits.push_back(view[i]);
+        std::stable_sort(hits.begin(), hits.end(), [](auto a, auto b) {
+            return *a["restarts"].to_double() < *b["restarts"].to_double();
+        });
+        std::map<std::string, size_t> perNode;
+        for (auto h : hits)
+            ++perNode[h["node"].as_str()];
+        handGroups = perNode.size();
+    }
+    std::cout << "hand-written loops:  " << std::fixed << std::setprecision(3) << secondsSince(start) << " s\n";
+
+    auto q = YamlParser::Query::compile("select(.restarts > 10) | sort_by(.restarts) | group_by(.node) | count");
+    for (size_t threads : {1u, 4u}) {
+        start = Clock::now();
+        size_t groups = 0;
+        for (int rep = 0; rep < reps; ++rep)
+            groups = q.run(view, threads).groups.size();
+        std::cout << "Query, " << threads << " thread(s):    " << secondsSince(start) << " s"
+                  << (groups == handGroups ? "" : "  (wrong result!)") << "\n";
+    }
+}
+
+// Flattening a tree with a million leaves, against recursive string concatenation, and rebuilding it.
+static void benchFlatten() {
+    YamlNode root(YamlNodeType::Mapping);
+    for (int a = 0; a < 100; ++a) {
+        YamlNode& svc = root.mapping["service_" + std::to_string(a)];
+        svc.type = YamlNodeType::Mapping;
+        for (int b = 0; b < 100; ++b) {
+            YamlNode& env = svc.mapping["env_" + std::to_string(b)];
+            env.type = YamlNodeType::Sequence;
+            for (int c = 0; c < 100; ++c)
+                env.sequence.emplace_back().scalarValue = std::to_string(c);
+        }
+    }
+    std::cout << "== flatten: 1000000 leaves\n";
+
+    std::function<void(const YamlNode&, std::string, size_t&)> naive = [&](const YamlNode& n, std::string prefix,
+                                                                          size_t& bytes) {
+        if (n.type == YamlNodeType::Scalar) {
+            bytes += prefix.size() + n.scalarValue.size();
+        } else if (n.type == YamlNodeType::Sequence) {
+            for (size_t i = 0; i < n.sequence.size(); ++i)
+                naive(n.sequence[i], prefix + "[" + std::to_string(i) + "]", bytes);
+        } else {
+            for (const auto& [k, v] : n.mapping)
+                naive(v, prefix.empty() ? k : prefix + "." + k, bytes);
+        }
+    };
+    auto start = Clock::now();
+    size_t naiveBytes = 0;
+    naive(root, "", naiveBytes);
+    std::cout << "recursive concat:   " << std::fixed << std::setprecision(3) << secondsSince(start) << " s\n";
+
+    start = Clock::now();
+    size_t bytes = 0;
+    YamlParser::flatten(root, [&](std::string_view path, const YamlNode& leaf) {
+        bytes += path.size() + leaf.scalarValue.size();
+    });
+    std::cout << "flatten (callback): " << secondsSince(start) << " s"
+              << (bytes == naiveBytes ? "" : "  (mismatch!)") << "\n";
+
+    start = Clock::now();
+    auto pairs = YamlParser::flattenToPairs(root);
+    std::cout << "flattenToPairs:     " << secondsSince(start) << " s\n";
+    start = Clock::now();
+    YamlNode back = YamlParser::unflatten(pairs);
+    std::cout << "unflatten:          " << secondsSince(start) << " s"
+              << (back.mapping.size() == root.mapping.size() ? "" : "  (wrong result!)") << "\n";
+}
+
+// Walking children by index and through the ranges, serially and on several threads.
+static void benchRanges() {
+    YamlNode root = makeLargeTree(50000);
+    YamlParser::NodeView view{&root};
+    std::cout << "== ranges: " << root.mapping.size() << " services\n";
+
+    auto start = Clock::now();
+    size_t bytes = 0;
+    for (const auto& kv : view.as_map()) {
+        YamlParser::NodeView hosts = YamlParser::NodeView{&kv.second}["hosts"];
+        for (size_t i = 0; i < hosts.as_seq().size(); ++i)
+            bytes += hosts[i].as_str().size();
+    }
+    std::cout << "as_map + index loop:     " << std::fixed << std::setprecision(3) << secondsSince(start) << " s\n";
+
+    start = Clock::now();
+    size_t rangeBytes = 0;
+    for (auto [name, svc] : view.items())
+        for (YamlParser::NodeView host : svc["hosts"].elements())
+            rangeBytes += host.as_str().size();
+    std::cout << "items() + elements():    " << secondsSince(start) << " s"
+              << (rangeBytes == bytes ? "" : "  (mismatch!)") << "\n";
+
+    start = Clock::now();
+    size_t nodes = 0;
+    for (YamlParser::NodeView v : view.descendants())
+        nodes += v.is_scalar();
+    std::cout << "descendants():           " << secondsSince(start) << " s (" << nodes << " scalars)\n";
+
+    for (size_t threads : {1u, 4u}) {
+        std::atomic<size_t> parallelBytes{0};
+        start = Clock::now();
+        YamlParser::forEachItemParallel(view, threads, [&](std::string_view, YamlParser::NodeView svc) {
+            size_t local = 0;
+            for (YamlParser::NodeView host : svc["hosts"].elements())
+                local += host.as_str().size();
+            parallelBytes += local;
+        });
+        std::cout << "forEachItemParallel, " << threads << ": " << secondsSince(start) << " s"
+                  << (parallelBytes.load() == bytes ? "" : "  (mismatch!)") << "\n";
+    }
+}
+
+// Looking up a value derived from each node: a side map keyed by node address against the node's attachment slot.
+static void benchAttachments() {
+    YamlNode root = makeLargeTree(20000);
+    std::vector<const YamlNode*> nodes;
+    for (const auto& [name, svc] : root.mapping)
+        for (const auto& [key, value] : svc.mapping)
+            if (value.type == YamlNodeType::Scalar)
+                nodes.push_back(&value);
+    const int reps = 20;
+    std::cout << "== attachments: " << nodes.size() << " scalars, " << reps << " lookups each\n";
+    auto derive = [](const YamlNode& n) { return n.scalarValue.size() * 31 + 7; };
+
+    std::unordered_map<const YamlNode*, size_t> side;
+    auto start = Clock::now();
+    size_t sideSum = 0;
+    for (int rep = 0; rep < reps; ++rep)
+        for (const YamlNode* n : nodes)
+            sideSum += side.try_emplace(n, derive(*n)).first->second;
+    std::cout << "side map:         " << std::fixed << std::setprecision(3) << secondsSince(start) << " s\n";
+
+    start = Clock::now();
+    size_t slotSum = 0;
+    for (int rep = 0; rep < reps; ++rep)
+        for (const YamlNode* n : nodes)
+            slotSum += n->attachment<size_t>(derive);
+    std::cout << "attachment slot:  " << secondsSince(start) << " s" << (slotSum == sideSum ? "" : "  (mismatch!)")
+              << "\n";
+}
+
+// Parsing with and without a ParseStats to collect; the disabled path should be indistinguishable from before.
+static void benchStats() {
+    const std::string text = YamlParser::toYamlString(makeLargeTree(20000));
+    const double mb = static_cast<double>(text.size()) / (1024.0 * 1024.0);
+    std::cout << "== parse stats: " << std::fixed << std::setprecision(1) << mb << " MB block YAML\n";
+    for (int collect = 0; collect < 2; ++collect) {
+        YamlParser::ParseStats stats;
+        auto start = Clock::now();
+        YamlNode root = YamlParser::parse(text, collect ? &stats : nullptr);
+        std::cout << (collect ? "with stats:    " : "without stats: ") << mb / secondsSince(start) << " MB/s\n";
+        if (collect) {
+            auto ms = [](std::chrono::nanoseconds d) { return std::chrono::duration<double, std::milli>(d).count(); };
+            std::cout << "  " << stats.lines << " lines, " << stats.nodes() << " nodes, depth " << stats.maxDepth
+                      << ", " << stats.allocations << " allocations (" << stats.allocatedBytes / 1024 << " KiB)\n"
+                      << "  scan " << ms(stats.scanTime) << " ms, block " << ms(stats.blockScalarTime) << " ms, flow "
+                      << ms(stats.flowTime) << " ms, build " << ms(stats.buildTime) << " ms\n";
+        }
+    }
+}
+
+// Cost of one trace event, and the trace of a parse plus a parallel emit (parser events need BASIC_YAML_TRACE=1).
+static void benchTrace() {
+    YamlParser::Trace::clear();
+    const int events = 1000000;
+    auto start = Clock::now();
+    for (int i = 0; i < events; ++i)
+        YamlParser::TraceScope scope("tick", static_cast<uint64_t>(i));
+    std::cout << "== trace: " << std::fixed << std::setprecision(1) << secondsSince(start) * 1e9 / events
+              << " ns per scoped event\n";
+
+    YamlParser::Trace::clear();
+    const std::string text = YamlParser::toYamlString(makeLargeTree(20000));
+    YamlParser::Trace::clear();
+    start = Clock::now();
+    YamlNode root = YamlParser::parse(text);
+    std::string out = YamlParser::toYamlStringParallel(root, 4);
+    double secs = secondsSince(start);
+    std::ostringstream trace;
+    YamlParser::Trace::writeChromeTrace(trace);
+    std::cout << "parse + emit:  " << std::setprecision(3) << secs << " s, "
+              << YamlParser::Trace::snapshot().size() << " events, " << trace.str().size() << " bytes of trace"
+              << (BASIC_YAML_TRACE ? "" : " (parser trace points compiled out)") << "\n";
+}
+
+// Keyed lookups, and the cost of counting a read (what every lookup pays with BASIC_YAML_ACCESS_TRACKING=1).
+static void benchAccess() {
+    YamlNode root = makeLargeTree(20000);
+    YamlParser::NodeView view{&root};
+    std::vector<std::string> names;
+    for (const auto& [name, svc] : root.mapping)
+        names.push_back(name);
+    const int reps = 20;
+    std::cout << "== access: " << names.size() << " services, " << reps << " passes"
+              << (BASIC_YAML_ACCESS_TRACKING ? " (lookups tracked)" : "") << "\n";
+
+    auto start = Clock::now();
+    size_t found = 0;
+    for (int rep = 0; rep < reps; ++rep)
+        for (const std::string& name : names)
+            found += static_cast<bool>(view[name]["field_3"]);
+    double lookup = secondsSince(start);
+    std::cout << "lookups:        " << std::fixed << std::setprecision(3) << lookup << " s\n";
+
+    start = Clock::now();
+    for (int rep = 0; rep < reps; ++rep)
+        for (const std::string& name : names) {
+            const YamlNode& svc = root.mapping.at(name);
+            YamlParser::recordAccess(svc);
+            YamlParser::recordAccess(svc.mapping.at("field_3"));
+        }
+    std::cout << "counted reads:  " << secondsSince(start) << " s"
+              << (found == names.size() * reps ? "" : "  (mismatch!)") << "\n";
+
+    start = Clock::now();
+    YamlParser::AccessReport report = YamlParser::accessReport(root);
+    std::cout << "report:         " << secondsSince(start) << " s (" << report.entries.size() << " paths, "
+              << report.unread.size() << " unread)\n";
+}
+
+int main(int argc, char** argv) {
+    struct Bench {
+        const char* name;
+        void (*fn)();
+    };
+    const Bench benches[] = {
+        {"contention", benchContention},
+        {"pipeline", benchPipeline},
+        {"emit", benchEmit},
+        {"quoting", benchQuoting},
+        {"json", benchJson},
+        {"jsonparse", benchJsonParse},
+        {"msgpack", benchMsgPack},
+        {"columns", benchColumns},
+        {"query", benchQuery},
+        {"flatten", benchFlatten},
+        {"ranges", benchRanges},
+        {"attachments", benchAttachments},
+        {"stats", benchStats},
+        {"trace", benchTrace},
+        {"access", benchAccess},
+    };
+    bool ran = false;
+    for (const Bench& b : benches) {
+        if (argc < 2 || std::strcmp(argv[1], b.name) == 0) {
+            b.fn();
+            ran = true;
+        }
+    }
+    if (!ran) {
+        std::cerr << "unknown benchmark: " << argv[1] << "\n";
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,72 @@
+// Build or query the sidecar offset index of a large YAML file.
+//
+// Usage:
+//   yaml_index build [--second-level] <file.yaml>    write <file.yaml>.yidx
+//   yaml_index list <file.yaml>                      print the indexed entries
+//   yaml_index get <file.yaml> <key> [doc]           print one key ("services" or "services.payments")
+//   yaml_index doc <file.yaml> <n>                   print document n
+
+#include <charconv>
+#include <cstdint>
+#include <cstring>
+#include <iostream>
+#include <string>
+
+#include "BasicYamlParser.hpp"
+
+static int usage() {
+    std::cerr << "usage: yaml_index build [--second-level] <file.yaml>\n"
+                 "       yaml_index list <file.yaml>\n"
+                 "       yaml_index get <file.yaml> <key> [doc]\n"
+                 "       yaml_index doc <file.yaml> <n>\n";
+    return 2;
+}
+
+// A document number: decimal digits only, within uint32_t.
+static bool parseDocNumber(const char* text, uint32_t& out) {
+    const char* end = text + std::strlen(text);
+    auto [ptr, ec] = std::from_chars(text, end, out);
+    return ec == std::errc() && ptr == end;
+}
+
+int main(int argc, char** argv) {
+    if (argc < 3)
+        return usage();
+    std::string cmd = argv[1];
+    try {
+        if (cmd == "build") {
+            bool second = std::strcmp(argv[2], "--second-level") == 0;
+            if (second && argc < 4)
+                return usage();
+            std::string file = argv[second ? 3 : 2];
+            YamlParser::OffsetIndex idx = YamlParser::buildIndex(file, second);
+            YamlParser::saveIndex(idx, file + ".yidx");
+            std::cout << idx.entries.size() << " entries written to " << file << ".yidx\n";
+        } else if (cmd == "list") {
+            YamlParser::OffsetIndex idx = YamlParser::openIndex(argv[2]);
+            for (const auto& e : idx.entries) {
+                std::cout << "doc " << e.doc << "  @" << e.offset << " +" << e.length << "  "
+                          << (e.level == YamlParser::OffsetIndex::DocumentStart ? "---" : e.key) << "\n";
+            }
+        } else if (cmd == "get" && argc >= 4) {
+            std::string key = argv[3];
+            uint32_t doc = 0;
+            if (argc >= 5 && !parseDocNumber(argv[4], doc))
+                return usage();
+            YamlParser::OffsetIndex idx = YamlParser::openIndex(argv[2], key.find('.') != std::string::npos);
+            std::cout << YamlParser::toYamlString(YamlParser::readIndexedKey(argv[2], idx, key, doc)) << "\n";
+        } else if (cmd == "doc" && argc >= 4) {
+            uint32_t n = 0;
+            if (!parseDocNumber(argv[3], n))
+                return usage();
+            YamlParser::OffsetIndex idx = YamlParser::openIndex(argv[2]);
+            std::cout << YamlParser::toYamlString(YamlParser::readIndexedDocument(argv[2], idx, n)) << "\n";
+        } else {
+            return usage();
+        }
+    } catch (const YamlError& e) {
+        std::cerr << "Error: " << e.what() << std::endl;
+        return 1;
+    }
+    return 0;
+}